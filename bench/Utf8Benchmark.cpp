@@ -0,0 +1,105 @@
+// Reads and writes a generated Cyrillic corpus through the UTF-8 paths of the exporter and through the Qt ones
+// they replaced: QString::fromUtf8 for reading and a QTextStream with the UTF-8 codec for writing decks.
+
+#include "Utf8.h"
+#include "Util.h"
+
+#include <QBuffer>
+#include <QTextStream>
+#include <QTime>
+#include <QCoreApplication>
+
+namespace
+{
+	const int CORPUS_LINES = 400000, ITERATIONS = 5;
+
+	// Database-like lines: mostly Russian words, some ASCII markup and numbers
+	QByteArray generateCorpus()
+	{
+		const char* words[] = { "Петр", "Великий", "основал", "Санкт-Петербург", "в", "году", "реформа", "армии", "флота",
+		                        "Сенат", "учреждение", "коллегий", "Северная", "война", "Полтавская", "битва" };
+		const int numWords = sizeof words / sizeof *words;
+
+		QByteArray corpus;
+		unsigned seed = 12345;
+
+		for (int line = 0; line < CORPUS_LINES; line++)
+		{
+			seed = seed * 1103515245 + 12345;
+			corpus += QByteArray::number (1700 + seed % 100) + " - ";
+
+			for (int word = 0; word < 8; word++)
+			{
+				seed = seed * 1103515245 + 12345;
+				corpus += words[(seed >> 8) % numWords];
+				corpus += word == 7 ? ".\n" : " ";
+			}
+		}
+
+		return corpus;
+	}
+
+	template <typename Function> int timeIt (Function function)
+	{
+		QTime timer;
+		timer.start();
+
+		for (int i = 0; i < ITERATIONS; i++)
+			function();
+
+		return timer.elapsed() / ITERATIONS;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	QCoreApplication application (argc, argv);
+	initializeStandardStreams();
+
+	QByteArray corpus = generateCorpus();
+	qstdout << "Corpus: " << corpus.size() << " bytes, " << CORPUS_LINES << " lines." << endl;
+
+	QString qtDecoded, decoded;
+	int qtRead = timeIt ([&] () { qtDecoded = QString::fromUtf8 (corpus); });
+	int read = timeIt ([&] ()
+	{
+		int errorOffset = 0;
+		verify (validateUtf8 (corpus.constData(), corpus.size(), errorOffset), "The corpus is not valid UTF-8.");
+		decoded = decodeUtf8 (corpus);
+	});
+
+	verify (decoded == qtDecoded, "Both read paths must decode the corpus the same way.");
+	qstdout << "Read:  fromUtf8 " << qtRead << " ms, validateUtf8 + decodeUtf8 " << read << " ms." << endl;
+
+	// Decks are written cell by cell
+	QStringList cells = decoded.split ('\n');
+	QByteArray qtWritten, written;
+
+	int qtWrite = timeIt ([&] ()
+	{
+		QBuffer buffer (&qtWritten);
+		buffer.open (QIODevice::WriteOnly | QIODevice::Truncate);
+		QTextStream stream (&buffer);
+		stream.setCodec ("UTF-8");
+
+		for (const QString& cell: cells)
+			stream << cell << '\n';
+		stream.flush();
+	});
+
+	int write = timeIt ([&] ()
+	{
+		QBuffer buffer (&written);
+		buffer.open (QIODevice::WriteOnly | QIODevice::Truncate);
+		Utf8Writer writer (buffer);
+
+		for (const QString& cell: cells)
+			writer << cell << '\n';
+		writer.flush();
+	});
+
+	verify (written == qtWritten, "Both write paths must produce the same bytes.");
+	qstdout << "Write: QTextStream " << qtWrite << " ms, Utf8Writer " << write << " ms." << endl;
+
+	return 0;
+}
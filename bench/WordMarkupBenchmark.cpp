@@ -0,0 +1,108 @@
+// Renders a generated dictionary of word-spelling markup with the compiled program and with the stack renderer
+// it replaced (still used for the words the compiler doesn't take).
+
+#include "WordSpellingMarkup.h"
+#include "Util.h"
+
+#include <QStringList>
+#include <QTime>
+#include <QCoreApplication>
+
+namespace
+{
+	const int DICTIONARY_WORDS = 500000;
+
+	class Generator
+	{
+	public :
+		Generator() :
+			seed (12345)
+		{}
+
+		int next (int bound)
+		{
+			seed = seed * 1103515245 + 12345;
+			return static_cast <int> ((seed >> 8) % static_cast <unsigned> (bound));
+		}
+
+		QString letters (int count)
+		{
+			const QString alphabet = QString::fromUtf8 ("абвгдеёжзийклмнопрстуфхцчшщъыьэюя");
+
+			QString result;
+			for (int i = 0; i < count; i++)
+				result += alphabet[next (alphabet.size())];
+			return result;
+		}
+
+	private :
+		unsigned seed;
+	};
+
+	// Words shaped like the ones in the dictionaries: letters with a stress, gaps, left out parts and remarks
+	QStringList generateDictionary()
+	{
+		Generator generator;
+		QStringList dictionary;
+
+		for (int i = 0; i < DICTIONARY_WORDS; i++)
+		{
+			QString word = generator.letters (1 + generator.next (4));
+
+			switch (generator.next (6))
+			{
+				case 0: word += "`" + generator.letters (1); break;
+				case 1: word += "(" + generator.letters (1 + generator.next (2)) + ")"; break;
+				case 2: word += "[" + generator.letters (2) + "]" + (generator.next (2) ? " " : "-"); break;
+				case 3: word += "!"; break;
+				case 4: word = "^" + word; break;
+				default: word += "{" + generator.letters (3) + "}"; break;
+			}
+
+			dictionary << word + generator.letters (1 + generator.next (5));
+		}
+
+		return dictionary;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	QCoreApplication application (argc, argv);
+	initializeStandardStreams();
+
+	QStringList dictionary = generateDictionary();
+	qstdout << "Dictionary: " << dictionary.size() << " words." << endl;
+
+	QVector <QString> stackQuestions (dictionary.size()), stackAnswers (dictionary.size());
+	QTime timer;
+	timer.start();
+
+	for (int i = 0; i < dictionary.size(); i++)
+		renderWordMarkupByStack (dictionary[i], stackQuestions[i], stackAnswers[i]);
+
+	int stackTime = timer.elapsed();
+
+	// One program is reused for all the words, the way the block parser does it
+	QVector <WordMarkupToken> program;
+	QVector <QString> questions (dictionary.size()), answers (dictionary.size());
+	timer.start();
+
+	for (int i = 0; i < dictionary.size(); i++)
+	{
+		verify (compileWordMarkup (dictionary[i], program), "Generated word '" + dictionary[i] + "' is not regular markup.");
+		renderWordMarkup (program, questions[i], answers[i]);
+	}
+
+	int compiledTime = timer.elapsed();
+
+	int mismatches = 0;
+	for (int i = 0; i < dictionary.size(); i++)
+		if (questions[i] != stackQuestions[i] || answers[i] != stackAnswers[i])
+			mismatches++;
+
+	verify (mismatches == 0, QString::number (mismatches) + " words were rendered differently.");
+	qstdout << "Stack renderer " << stackTime << " ms, compiled program " << compiledTime << " ms." << endl;
+
+	return 0;
+}
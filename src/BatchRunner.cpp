@@ -0,0 +1,153 @@
+#include "BatchRunner.h"
+#include "SceneryExecutor.h"
+#include "Util.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QTime>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <functional>
+
+namespace
+{
+	class FunctionTask : public QRunnable
+	{
+	public :
+		FunctionTask (std::function <void()> function) :
+			function (function)
+		{}
+
+		void run()
+		{
+			function();
+		}
+
+	private :
+		std::function <void()> function;
+	};
+}
+
+void BatchRunner::addScenery (QString sceneryFileName)
+{
+	sceneryFileNames << sceneryFileName;
+}
+
+void BatchRunner::addManifest (QString manifestFileName)
+{
+	QPair <QString, QString> manifestContents = FileReaderSingletone::instance().readContents (manifestFileName, "global");
+	QDir manifestDirectory = QFileInfo (manifestContents.second).dir();
+
+	for (QString line: manifestContents.first.split ('\n'))
+	{
+		int commentBegining = line.indexOf ('#');
+		if (commentBegining != -1)
+			line = line.left (commentBegining);
+		line = line.trimmed();
+
+		if (!line.isEmpty())
+			sceneryFileNames << manifestDirectory.absoluteFilePath (FileReaderSingletone::instance().expandPathMacros (line));
+	}
+}
+
+bool BatchRunner::run (bool incremental)
+{
+	int numSceneries = sceneryFileNames.size();
+	QVector < shared_ptr <SceneryExecutor> > executors (numSceneries);
+	QVector <QString> sceneryPaths (numSceneries);
+	bool allParsed = true;
+
+	for (int i = 0; i < numSceneries; i++)
+	{
+		QPair <QString, QString> sceneryContents = FileReaderSingletone::instance().readContents (sceneryFileNames[i], "global");
+		sceneryPaths[i] = sceneryContents.second;
+
+		shared_ptr <SceneryExecutor> executor (new SceneryExecutor (sceneryContents.first));
+		if (!executor->parse())
+		{
+			qstdout << "There were parse errors in scenery '" << sceneryPaths[i] << "', skipping it." << endl;
+			allParsed = false;
+			continue;
+		}
+
+		executor->setSceneryFileName (sceneryPaths[i]);
+		executors[i] = executor;
+	}
+
+	// Sceneries writing the same deck file are chained into one group (union-find over deck paths)
+	QVector <int> group (numSceneries);
+	for (int i = 0; i < numSceneries; i++)
+		group[i] = i;
+
+	std::function <int (int)> findGroup = [&] (int i) { return group[i] == i ? i : group[i] = findGroup (group[i]); };
+
+	QMap <QString, int> deckWriters;
+	for (int i = 0; i < numSceneries; i++)
+	{
+		if (!executors[i]) continue;
+
+		for (QString deckPath: executors[i]->getSavedDeckPaths())
+		{
+			if (deckWriters.count (deckPath) > 0)
+				group[findGroup (i)] = findGroup (deckWriters[deckPath]);
+			deckWriters[deckPath] = i;
+		}
+	}
+
+	QMap < int, QVector <int> > groups;
+	for (int i = 0; i < numSceneries; i++)
+		if (executors[i])
+			groups[findGroup (i)].push_back (i);
+
+	// One budget of threads for the whole batch: the sceneries running at once share the cores between their commands
+	int threadBudget = qMax (1, QThread::idealThreadCount()), concurrentSceneries = qMax (1, qMin (groups.size(), threadBudget));
+	for (shared_ptr <SceneryExecutor>& executor: executors)
+		if (executor)
+			executor->setMaxThreads (qMax (1, threadBudget / concurrentSceneries));
+
+	QThreadPool pool;
+	pool.setMaxThreadCount (concurrentSceneries);
+
+	// A failed scenery mustn't take the others down; later sceneries of its group still run, as they would alone
+	QMutex failedMutex;
+	bool anyFailed = false;
+
+	for (QVector <int> members: groups)
+		pool.start (new FunctionTask ([&, members] ()
+		{
+			for (int i: members)
+			{
+				QTime timer;
+				timer.start();
+
+				bool previousRecoverable = setRecoverableFailures (true);
+				StandardStreamsCapture capture;
+				qstdout << "Running scenery '" << sceneryPaths[i] << "'." << endl;
+
+				try
+				{
+					if (incremental)
+						executors[i]->executeIncrementally();
+					else
+						executors[i]->execute();
+
+					qstdout << "Scenery '" << sceneryPaths[i] << "' finished in " << timer.elapsed() << " ms.\n" << endl;
+				}
+				catch (HaltException&)
+				{
+					qstdout << "Scenery '" << sceneryPaths[i] << "' failed after " << timer.elapsed() << " ms.\n" << endl;
+
+					QMutexLocker locker (&failedMutex);
+					anyFailed = true;
+				}
+
+				setRecoverableFailures (previousRecoverable);
+			}
+		}));
+
+	pool.waitForDone();
+	return allParsed && !anyFailed;
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <QString>
+#include <QStringList>
+
+// Runs several sceneries in one process, so that they share the caches of file contents, compiled
+// expressions and media hashes. Sceneries saving to the same deck file run one after another in the
+// given order, the others concurrently. Output of every scenery is printed at once when it finishes.
+class BatchRunner
+{
+public :
+	void addScenery (QString sceneryFileName);
+
+	// Manifest lines are scenery paths, relative to the manifest; '#' starts a comment
+	void addManifest (QString manifestFileName);
+
+	// Returns false if any scenery failed to parse or to run
+	bool run (bool incremental);
+
+private :
+	QStringList sceneryFileNames;
+};
+
+#endif // BATCH_RUNNER_H
@@ -1,10 +1,14 @@
 #include "DatabaseExporter.h"
+#include "ResourceCopier.h"
+#include "MediaManifest.h"
+#include "ExternalRowStore.h"
 
 #include <QFile>
 #include <QStringList>
 #include <QDir>
 #include <QDateTime>
-#include <QProcess>
+#include <QCryptographicHash>
+#include <QMutexLocker>
 
 void DatabaseExporter::printMessages()
 {
@@ -40,22 +44,133 @@ void DatabaseExporter::printMessages()
 
 void DatabaseExporter::dump()
 {
-	for (shared_ptr <SimpleFlashcard> e: database->entries)
+	for (int i = 0; i < database->entryCount(); i++)
 	{
-        e->dump (qstdout);
+        database->entry (i)->dump (qstdout);
 	}
 }
 
-void FlashcardsDeck::writeDeck (QTextStream& stream)
+void FlashcardsDeck::writeDeck (Utf8Writer& writer)
 {
-	stream.setCodec("UTF-8");
-
 	for (unsigned i = 0; i < usedColumns.size(); i++)
-		stream << usedColumns[i] << ((i + 1) == usedColumns.size() ? "\n" : "\t");
+		writer << usedColumns[i] << ((i + 1) == usedColumns.size() ? '\n' : '\t');
+
+	if (rowSink)
+		rowSink->writeRows (writer, static_cast <int> (usedColumns.size()));
+
+	if (spilledRows)
+		spilledRows->writeRows (writer, static_cast <int> (usedColumns.size()));
 
 	for (std::map <int, QString>& row : exportData)
 		for (unsigned i = 0; i < usedColumns.size(); i++)
-			stream << row[i] << ((i + 1) == usedColumns.size() ? "\n" : "\t");
+			writer << row[i] << ((i + 1) == usedColumns.size() ? '\n' : '\t');
+}
+
+namespace
+{
+	// Write-only device computing the fingerprint of everything written to it
+	class FingerprintDevice : public QIODevice
+	{
+	public :
+		FingerprintDevice() :
+			hash (QCryptographicHash::Sha1), bytesWritten (0)
+		{
+			open (QIODevice::WriteOnly);
+		}
+
+		QString fingerprint()
+		{
+			return QString::fromLatin1 (hash.result().toHex()) + "\t" + QString::number (bytesWritten);
+		}
+
+	protected :
+		qint64 readData (char*, qint64)
+		{
+			return -1;
+		}
+
+		qint64 writeData (const char* data, qint64 length)
+		{
+			hash.addData (data, static_cast <int> (length));
+			bytesWritten += length;
+			return length;
+		}
+
+	private :
+		QCryptographicHash hash;
+		qint64 bytesWritten;
+	};
+
+	// Removes the fallback state of an entry when it goes out of scope, also if the export halts
+	class FallbackStateGuard
+	{
+	public :
+		FallbackStateGuard (SimpleFlashcard* entry, VariableStackState fallback) :
+			entry (entry)
+		{
+			entry->setFallbackVariableStackState (fallback);
+		}
+
+		~FallbackStateGuard()
+		{
+			entry->removeFallbackVariableStackState();
+		}
+
+	private :
+		SimpleFlashcard* entry;
+
+		FallbackStateGuard (const FallbackStateGuard&) = delete;
+	};
+
+	QString deckFingerprintPath (QString deckFileName)
+	{
+		QFileInfo deckFile (deckFileName);
+		return deckFile.dir().filePath ("." + deckFile.fileName() + ".fingerprint");
+	}
+}
+
+bool FlashcardsDeck::saveDeck (QString deckFileName, QString mediaDirectoryUrl)
+{
+	QString header = "*\tmedia-dir\t" + mediaDirectoryUrl + "\n";
+
+	QString fingerprint;
+	{
+		FingerprintDevice fingerprintDevice;
+		Utf8Writer writer (fingerprintDevice);
+		writer << header;
+		writeDeck (writer);
+		writer.flush();
+		fingerprint = fingerprintDevice.fingerprint();
+	}
+
+	// The recorded modification time catches decks edited or replaced by someone else
+	QFileInfo deckFile (deckFileName);
+	QFile fingerprintFile (deckFingerprintPath (deckFileName));
+	if (deckFile.exists() && fingerprintFile.open (QIODevice::ReadOnly | QIODevice::Text))
+	{
+		QString recorded = QString::fromUtf8 (fingerprintFile.readAll()).trimmed();
+		fingerprintFile.close();
+
+		if (recorded == fingerprint + "\t" + QString::number (deckFile.lastModified().toMSecsSinceEpoch()))
+			return false;
+	}
+
+	{
+		QFile exportTo (deckFileName);
+		verify (exportTo.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to open save destination file '" + deckFileName + "'.");
+
+		Utf8Writer writer (exportTo);
+		writer << header;
+		writeDeck (writer);
+		writer.flush();
+	}
+
+	verify (fingerprintFile.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to write deck fingerprint '" + fingerprintFile.fileName() + "'.");
+	QString modified = QString::number (QFileInfo (deckFileName).lastModified().toMSecsSinceEpoch());
+	fingerprintFile.write ((fingerprint + "\t" + modified + "\n").toUtf8());
+	fingerprintFile.close();
+
+	return true;
 }
 
 void FlashcardsDeck::setColumnValue (QString columnName, QString columnValue)
@@ -79,12 +194,89 @@ void FlashcardsDeck::setColumnValue (QString columnName, QString columnValue)
 
 void FlashcardsDeck::submitRow()
 {
-	exportData.push_back (currentRow);
+	if (rowSink)
+	{
+		rowSink->consumeRow (usedColumns, currentRow);
+	}
+	else
+	{
+		// Rough estimate of what a row costs, containers overhead included
+		exportDataBytes += 64;
+		for (auto& cell: currentRow)
+			exportDataBytes += 64 + 2 * cell.second.size();
+
+		exportData.push_back (currentRow);
+
+		if (memoryBudget > 0 && exportDataBytes > memoryBudget)
+			spillRows();
+	}
+
 	currentRow.clear();
 }
 
+void FlashcardsDeck::setMemoryBudget (qint64 bytes)
+{
+	memoryBudget = bytes;
+}
+
+void FlashcardsDeck::spillRows()
+{
+	if (!spilledRows)
+		spilledRows.reset (new ExternalRowStore (memoryBudget));
+
+	for (const std::map <int, QString>& row: exportData)
+		spilledRows->appendRow (row);
+
+	std::vector < std::map <int, QString> >().swap (exportData);
+	exportDataBytes = 0;
+}
+
+QString deckRowToLine (const std::map <int, QString>& row)
+{
+	QString line = "";
+	int fieldCount = row.empty() ? 0 : row.rbegin()->first + 1;
+	for (int i = 0; i < fieldCount; i++)
+	{
+		if (i > 0)
+			line += '\t';
+
+		auto cell = row.find (i);
+		if (cell != row.end())
+			line += cell->second;
+	}
+	return line;
+}
+
+void writeDeckRowLine (Utf8Writer& writer, const QByteArray& line, int columnCount)
+{
+	// Spooled lines are UTF-8 already
+	writer << line;
+	for (int fields = line.count ('\t') + 1; fields < columnCount; fields++)
+		writer << '\t';
+	writer << '\n';
+}
+
+void FlashcardsDeck::setRowSink (shared_ptr <DeckRowSink> sink)
+{
+	rowSink = sink;
+}
+
+bool FlashcardsDeck::isStreamed()
+{
+	return rowSink != nullptr;
+}
+
 void FlashcardsDeck::removeDuplicates()
 {
+	verify (!rowSink, "Duplicates can't be removed from a streamed deck.");
+
+	if (spilledRows)
+	{
+		spillRows();
+		spilledRows->removeDuplicates();
+		return;
+	}
+
 	// Could be done with unique, but don't mess up the ordering.
 
 	std::vector < std::map <int, QString> > exportDataOld = exportData;
@@ -108,7 +300,9 @@ QString FlashcardsDeck::getResourceDeckPath (QString resourceAbsolutePath)
 	int dotPosition = resourceAbsolutePath.lastIndexOf ('.');
 	verify (dotPosition != -1, "Resource '" + resourceAbsolutePath + "' has no extension.");
 	QString extension = resourceAbsolutePath.right (resourceAbsolutePath.length() - dotPosition);
-	QString newName = QString::number (resourceAbsoluteToDeckPathMap.size() + 1) + extension;
+
+	// Names depend on contents only, so adding a resource doesn't rename the others
+	QString newName = fileContentHash (resourceAbsolutePath) + extension;
 	resourceAbsoluteToDeckPathMap[resourceAbsolutePath] = newName;
 	return newName;
 }
@@ -118,64 +312,94 @@ void FlashcardsDeck::setMediaDirectoryName (QString name)
 	mediaDirectoryName = name;
 }
 
-void FlashcardsDeck::saveResources (QString deckFileName, bool verbose)
+void FlashcardsDeck::saveResources (QString deckFileName, bool verbose, bool allowHardLinks)
 {
-	if (resourceAbsoluteToDeckPathMap.empty()) return;
+	QDir createMediaIn = QFileInfo (deckFileName).dir();
+
+	// A media directory left from previous saves still has to be cleaned up
+	if (resourceAbsoluteToDeckPathMap.empty() && (mediaDirectoryName.isEmpty() || !createMediaIn.exists (mediaDirectoryName))) return;
 	verify (!(mediaDirectoryName.isEmpty() || mediaDirectoryName.isNull()), "Media directory not specified or empty.");
 
-	QDir createMediaIn = QFileInfo (deckFileName).dir();
 	verify (createMediaIn.exists(), "Failed to access parent directory of '" + deckFileName + "'.");
 
 	verify (createMediaIn.mkpath (mediaDirectoryName), "Failed to create media subdirectory '" + mediaDirectoryName + "' for deck file '" + deckFileName +"'.");
+	QString mediaDirectory = createMediaIn.absolutePath() + "/" + mediaDirectoryName;
+
+	// Other decks may be saving into the same directory at the same time
+	QMutexLocker directoryLocker (&MediaManifest::lockDirectory (mediaDirectory));
+
+	MediaManifest manifest;
+	manifest.load (mediaDirectory);
+
+	ResourceCopier copier (allowHardLinks);
+	QSet <QString> usedNames;
 
 	for (std::pair <QString, QString> absoluteToRelative : resourceAbsoluteToDeckPathMap.toStdMap())
 	{
-		QString destination = createMediaIn.absolutePath() + "/" + mediaDirectoryName + "/" + absoluteToRelative.second;
+		// Identical contents under different source paths share one file
+		if (usedNames.contains (absoluteToRelative.second))
+			continue;
+		usedNames.insert (absoluteToRelative.second);
+
+		QString destination = mediaDirectory + "/" + absoluteToRelative.second;
 
-		QFileInfo sourceFile (absoluteToRelative.first), destinationFile (destination);
-		if (destinationFile.exists() && sourceFile.lastModified() == destinationFile.lastModified() && sourceFile.size() == destinationFile.size())
+		if (manifest.isUpToDate (absoluteToRelative.second, QFileInfo (destination)))
 		{
 			if (verbose)
-				qstderr << "File '" << absoluteToRelative.first << "' has same last accessed time as '" << destination << "': skipping." << endl;
+				qstderr << "File '" << absoluteToRelative.first << "' is already present as '" << destination << "': skipping." << endl;
 			continue;
 		}
 
-		//bool copied = QFile::copy (absoluteToRelative.first, destination);
+		copier.enqueue (QFileInfo (absoluteToRelative.first).absoluteFilePath(), destination);
+	}
+
+	int copiedCount = 0;
+	for (const ResourceCopier::CopyResult& result: copier.run())
+	{
+		verify (result.copied, "Failed to copy '" + result.source + "' to '" + result.destination + "': " + result.error);
+
+		QString name = QFileInfo (result.destination).fileName();
+		manifest.update (name, name.left (name.lastIndexOf ('.')), QFileInfo (result.destination));
+		copiedCount++;
 
-		// Copy preserving timestamps via 'cp'
-		bool copied = false;
+		if (verbose)
+			qstderr << "Copied resource '" + result.source + "' to '" + result.destination + "' (" + result.method + ")." << endl;
+	}
 
-#ifdef  Q_OS_LINUX
-		QProcess process;
-		process.start ("cp", QStringList() << sourceFile.absoluteFilePath() << destinationFile.absoluteFilePath() << "--preserve=timestamps");
-		verify (process.waitForFinished(), "Failed to wait for 'cp' to finish.");
-		copied = process.exitCode() == 0;
-#else
-#error This platform is not supported. Add more cases or test if the existing code works.
-#endif
+	manifest.setDeckResources (QFileInfo (deckFileName).absoluteFilePath(), usedNames);
 
-		verify (copied, "Failed to copy '" + absoluteToRelative.first + "' to '" + destination + "'.");
+	int removedCount = 0;
+	for (QString orphan: manifest.orphans())
+	{
+		QString orphanPath = mediaDirectory + "/" + orphan;
+		verify (!QFile::exists (orphanPath) || QFile::remove (orphanPath), "Failed to remove orphaned resource '" + orphanPath + "'.");
+		manifest.remove (orphan);
+		removedCount++;
 
 		if (verbose)
-			qstderr << "Copied resource '" + absoluteToRelative.first + "' to '" + destination + "'." << endl;
+			qstderr << "Removed orphaned resource '" << orphanPath << "'." << endl;
 	}
+
+	manifest.save (mediaDirectory);
+	saveKnownHashes (mediaDirectory, resourceAbsoluteToDeckPathMap.keys());
+
 	if (verbose)
-		qstderr << resourceAbsoluteToDeckPathMap.size() << " resources saved." << endl;
+		qstderr << usedNames.size() << " resources saved (" << copiedCount << " copied, " << removedCount << " removed)." << endl;
 }
 
 void DatabaseExporter::exportDatabase (FlashcardsDeck* exportTo, VariableStackState exportArguments)
 {
-	for (shared_ptr <SimpleFlashcard> e: database->entries)
+	for (int i = 0; i < database->entryCount(); i++)
     {
-        e->setFallbackVariableStackState (exportArguments);
+        const shared_ptr <SimpleFlashcard>& e = database->entry (i);
+		FallbackStateGuard guard (e.get(), exportArguments);
 		exportEntry (exportTo, e.get());
-        e->removeFallbackVariableStackState();
     }
 }
 
 QString stringToFlashcardsFormat (QString string)
 {
-	return string.replace ('\n', '|').replace ('\t', "    ").replace (QRegExp ("`([^`])"), "\\1&#769;");
+	return string.replace ('\n', '|').replace ('\t', "    ").replace (sharedRegExp ("`([^`])"), "\\1&#769;");
 }
 
 void DatabaseExporter::exportEntry (FlashcardsDeck* exportTo, SimpleFlashcard* entry)
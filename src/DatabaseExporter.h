@@ -3,24 +3,56 @@
 
 #include "FlashcardsDatabase.h"
 #include "FlashcardUtilities.h"
+#include "Utf8.h"
 
 #include <set>
 #include <map>
 #include <vector>
 #include <algorithm>
 
+// Spooled rows are stored one per line with as many fields as there were columns at submission time
+QString deckRowToLine (const std::map <int, QString>& row);
+void writeDeckRowLine (Utf8Writer& writer, const QByteArray& line, int columnCount);
+
+class ExternalRowStore;
+
+// Takes over deck rows as they are submitted, so that the deck doesn't have to keep them
+class DeckRowSink
+{
+public :
+	virtual ~DeckRowSink() {}
+
+	// Columns are the ones known so far; row maps column indices to values
+	virtual void consumeRow (const std::vector <QString>& columns, const std::map <int, QString>& row) = 0;
+
+	// Writes all consumed rows padded to the final number of columns
+	virtual void writeRows (Utf8Writer& writer, int columnCount) = 0;
+};
+
 class FlashcardsDeck
 {
 public :
+	// Rows submitted after this call go to the sink instead of being kept in memory
+	void setRowSink (shared_ptr <DeckRowSink> sink);
+	bool isStreamed();
 
 	void setColumnValue (QString columnName, QString columnValue);
 	void submitRow();
 
-	void writeDeck (QTextStream& stream);
-	void saveResources (QString deckFileName, bool verbose = false);
+	void writeDeck (Utf8Writer& writer);
+
+	// Writes the deck preceded by the media directory header. Returns false and leaves the file untouched
+	// if the rendered deck matches the fingerprint recorded by the previous save.
+	bool saveDeck (QString deckFileName, QString mediaDirectoryUrl);
+
+	// Resources unchanged since the last save are skipped, the rest are copied in parallel
+	void saveResources (QString deckFileName, bool verbose = false, bool allowHardLinks = false);
 
 	void removeDuplicates();
 
+	// Once rows take more than the budget (in bytes, 0 for no limit), they are moved to disk
+	void setMemoryBudget (qint64 bytes);
+
 	void setMediaDirectoryName (QString name);
 	QString getResourceDeckPath (QString resourceAbsolutePath);
 
@@ -32,6 +64,14 @@ private :
 	std::vector < std::map <int, QString> > exportData;
 	std::map <int, QString> currentRow;
 
+	shared_ptr <DeckRowSink> rowSink;
+
+	// Rows moved out of memory; they precede the ones in exportData
+	shared_ptr <ExternalRowStore> spilledRows;
+	qint64 memoryBudget = 0, exportDataBytes = 0;
+
+	void spillRows();
+
 	QString mediaDirectoryName;
 	QMap <QString, QString> resourceAbsoluteToDeckPathMap;
 };
@@ -0,0 +1,84 @@
+#include "DateIntervalIndex.h"
+
+#include <algorithm>
+
+void radixSortByKeys (QVector <int>& positions, const QVector <quint32>& keys)
+{
+	QVector <int> buffer (positions.size());
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		int counts[257] = {};
+		for (int position: positions)
+			counts[((keys[position] >> shift) & 0xFF) + 1]++;
+
+		// All keys share the digit, the pass would not move anything
+		if (std::count (counts + 1, counts + 257, 0) == 255)
+			continue;
+
+		for (int digit = 0; digit < 256; digit++)
+			counts[digit + 1] += counts[digit];
+
+		for (int position: positions)
+			buffer[counts[(keys[position] >> shift) & 0xFF]++] = position;
+
+		positions.swap (buffer);
+	}
+}
+
+void DateIntervalIndex::build (const QVector <quint32>& beginKeys, const QVector <quint32>& endKeys, const EntryBitmap& dated)
+{
+	numEntries = dated.size();
+	entries = dated.indices();
+	radixSortByKeys (entries, beginKeys);
+
+	begins.resize (entries.size());
+	ends.resize (entries.size());
+	for (int i = 0; i < entries.size(); i++)
+	{
+		begins[i] = beginKeys[entries[i]];
+		ends[i] = endKeys[entries[i]];
+	}
+
+	maxEnds.resize (entries.size());
+	buildMaxEnds (0, entries.size());
+}
+
+quint32 DateIntervalIndex::buildMaxEnds (int low, int high)
+{
+	if (low >= high)
+		return 0;
+
+	int middle = (low + high) / 2;
+	maxEnds[middle] = std::max (ends[middle], std::max (buildMaxEnds (low, middle), buildMaxEnds (middle + 1, high)));
+	return maxEnds[middle];
+}
+
+EntryBitmap DateIntervalIndex::overlapping (quint32 fromKey, quint32 toKey) const
+{
+	EntryBitmap result (numEntries);
+	collect (0, entries.size(), fromKey, toKey, result);
+	return result;
+}
+
+void DateIntervalIndex::collect (int low, int high, quint32 fromKey, quint32 toKey, EntryBitmap& result) const
+{
+	if (low >= high)
+		return;
+
+	// Everything below ends before the queried period
+	int middle = (low + high) / 2;
+	if (maxEnds[middle] < fromKey)
+		return;
+
+	collect (low, middle, fromKey, toKey, result);
+
+	// The right subtree and the node itself begin after the queried period
+	if (begins[middle] > toKey)
+		return;
+
+	if (ends[middle] >= fromKey)
+		result.set (entries[middle]);
+
+	collect (middle + 1, high, fromKey, toKey, result);
+}
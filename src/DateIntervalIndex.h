@@ -0,0 +1,30 @@
+#ifndef DATE_INTERVAL_INDEX_H
+#define DATE_INTERVAL_INDEX_H
+
+#include <QVector>
+
+#include "EntryBitmap.h"
+
+// Stable LSD radix sort of positions by their keys (keys are indexed by position)
+void radixSortByKeys (QVector <int>& positions, const QVector <quint32>& keys);
+
+// Periods of the dated entries of a database, sorted by begin date and arranged as an implicit binary search
+// tree, each node knowing the latest end date below it. Overlap queries take O(log n + k) for k results.
+class DateIntervalIndex
+{
+public :
+	void build (const QVector <quint32>& beginKeys, const QVector <quint32>& endKeys, const EntryBitmap& dated);
+
+	// Entries whose periods share at least a day with [fromKey, toKey]
+	EntryBitmap overlapping (quint32 fromKey, quint32 toKey) const;
+
+private :
+	int numEntries = 0;
+	QVector <int> entries;
+	QVector <quint32> begins, ends, maxEnds;
+
+	quint32 buildMaxEnds (int low, int high);
+	void collect (int low, int high, quint32 fromKey, quint32 toKey, EntryBitmap& result) const;
+};
+
+#endif // DATE_INTERVAL_INDEX_H
@@ -0,0 +1,74 @@
+#include "EntryBitmap.h"
+#include "Util.h"
+
+EntryBitmap::EntryBitmap (int size, bool value) :
+	bitCount (size), words ((size + 63) / 64, value ? ~quint64 (0) : 0)
+{
+	clearTail();
+}
+
+int EntryBitmap::size() const
+{
+	return bitCount;
+}
+
+bool EntryBitmap::test (int index) const
+{
+	return (words[index >> 6] >> (index & 63)) & 1;
+}
+
+void EntryBitmap::set (int index)
+{
+	words[index >> 6] |= quint64 (1) << (index & 63);
+}
+
+EntryBitmap& EntryBitmap::operator&= (const EntryBitmap& other)
+{
+	assert (bitCount == other.bitCount, "Bitmaps of different databases combined.");
+	for (int i = 0; i < words.size(); i++)
+		words[i] &= other.words[i];
+	return *this;
+}
+
+EntryBitmap& EntryBitmap::operator|= (const EntryBitmap& other)
+{
+	assert (bitCount == other.bitCount, "Bitmaps of different databases combined.");
+	for (int i = 0; i < words.size(); i++)
+		words[i] |= other.words[i];
+	return *this;
+}
+
+EntryBitmap EntryBitmap::operator~() const
+{
+	EntryBitmap result (*this);
+	for (quint64& word: result.words)
+		word = ~word;
+	result.clearTail();
+	return result;
+}
+
+int EntryBitmap::count() const
+{
+	int result = 0;
+	for (quint64 word: words)
+		result += __builtin_popcountll (word);
+	return result;
+}
+
+QVector <int> EntryBitmap::indices() const
+{
+	QVector <int> result;
+	result.reserve (count());
+
+	for (int i = 0; i < words.size(); i++)
+		for (quint64 word = words[i]; word != 0; word &= word - 1)
+			result.push_back (i * 64 + __builtin_ctzll (word));
+
+	return result;
+}
+
+void EntryBitmap::clearTail()
+{
+	if (bitCount % 64 != 0)
+		words.last() &= (quint64 (1) << (bitCount % 64)) - 1;
+}
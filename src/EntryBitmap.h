@@ -0,0 +1,33 @@
+#ifndef ENTRY_BITMAP_H
+#define ENTRY_BITMAP_H
+
+#include <QVector>
+
+// A set of entry indices of one database, one bit per entry
+class EntryBitmap
+{
+public :
+	EntryBitmap (int size = 0, bool value = false);
+
+	int size() const;
+	bool test (int index) const;
+	void set (int index);
+
+	EntryBitmap& operator&= (const EntryBitmap& other);
+	EntryBitmap& operator|= (const EntryBitmap& other);
+	EntryBitmap operator~() const;
+
+	int count() const;
+
+	// Indices of the set bits in increasing order
+	QVector <int> indices() const;
+
+private :
+	int bitCount;
+	QVector <quint64> words;
+
+	// Bits past the end are kept zero, so that counting and complementing work word by word
+	void clearTail();
+};
+
+#endif // ENTRY_BITMAP_H
@@ -0,0 +1,345 @@
+#include "ExporterDaemon.h"
+#include "SceneryExecutor.h"
+#include "Json.h"
+#include "Util.h"
+
+#include <QTime>
+#include <QVariant>
+
+#ifndef Q_OS_LINUX
+#error This platform is not supported. Add more cases or test if the existing code works.
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace
+{
+	QString systemError (QString what)
+	{
+		return what + ": " + QString::fromLocal8Bit (strerror (errno));
+	}
+
+	sockaddr_un socketAddress (QString socketPath)
+	{
+		sockaddr_un address;
+		memset (&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+
+		QByteArray path = socketPath.toLocal8Bit();
+		verify (path.size() < (int) sizeof address.sun_path, "Socket path '" + socketPath + "' is too long.");
+		memcpy (address.sun_path, path.constData(), path.size());
+
+		return address;
+	}
+
+	int connectTo (QString socketPath)
+	{
+		sockaddr_un address = socketAddress (socketPath);
+
+		int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		verify (fd >= 0, systemError ("Failed to create a socket"));
+
+		if (connect (fd, reinterpret_cast <sockaddr*> (&address), sizeof address) != 0)
+		{
+			close (fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	bool sendLine (int fd, QString line)
+	{
+		QByteArray data = line.toUtf8();
+		data += '\n';
+
+		for (int sent = 0; sent < data.size();)
+		{
+			// A client that went away must not kill the daemon with SIGPIPE
+			ssize_t result = send (fd, data.constData() + sent, static_cast <size_t> (data.size() - sent), MSG_NOSIGNAL);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+				return false;
+
+			sent += static_cast <int> (result);
+		}
+
+		return true;
+	}
+
+	class LineReader
+	{
+	public :
+		LineReader (int fd) :
+			fd (fd)
+		{}
+
+		bool readLine (QByteArray& line)
+		{
+			for (;;)
+			{
+				int end = buffer.indexOf ('\n');
+				if (end != -1)
+				{
+					line = buffer.left (end);
+					buffer.remove (0, end + 1);
+					return true;
+				}
+
+				char chunk[64 * 1024];
+				ssize_t received = recv (fd, chunk, sizeof chunk, 0);
+				if (received < 0 && errno == EINTR)
+					continue;
+				if (received <= 0)
+					return false;
+
+				buffer.append (chunk, static_cast <int> (received));
+			}
+		}
+
+	private :
+		int fd;
+		QByteArray buffer;
+	};
+}
+
+ExporterDaemon::ExporterDaemon (QString socketPath) :
+	socketPath (socketPath), listenFd (-1), executor (new SceneryExecutor ("")), shutdownRequested (false)
+{}
+
+ExporterDaemon::~ExporterDaemon()
+{
+	if (listenFd >= 0)
+	{
+		close (listenFd);
+		unlink (socketPath.toLocal8Bit().constData());
+	}
+}
+
+void ExporterDaemon::run()
+{
+	// A socket left by a daemon that died is taken over, a live daemon is not
+	int probeFd = connectTo (socketPath);
+	if (probeFd >= 0)
+	{
+		close (probeFd);
+		failure ("Another daemon is listening on '" + socketPath + "'.");
+	}
+	unlink (socketPath.toLocal8Bit().constData());
+
+	sockaddr_un address = socketAddress (socketPath);
+	listenFd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	verify (listenFd >= 0, systemError ("Failed to create a socket"));
+	verify (bind (listenFd, reinterpret_cast <sockaddr*> (&address), sizeof address) == 0, systemError ("Failed to bind to '" + socketPath + "'"));
+	verify (listen (listenFd, 16) == 0, systemError ("Failed to listen on '" + socketPath + "'"));
+
+	qstdout << "Listening on '" << socketPath << "'." << endl;
+
+	setRecoverableFailures (true);
+
+	while (!shutdownRequested)
+	{
+		int connectionFd = accept4 (listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (connectionFd < 0 && errno == EINTR)
+			continue;
+
+		if (connectionFd < 0)
+		{
+			setRecoverableFailures (false);
+			failure (systemError ("Failed to accept a connection"));
+		}
+
+		serveConnection (connectionFd);
+		close (connectionFd);
+	}
+
+	setRecoverableFailures (false);
+	qstdout << "Shutting down." << endl;
+}
+
+void ExporterDaemon::serveConnection (int connectionFd)
+{
+	LineReader reader (connectionFd);
+	QByteArray line;
+
+	while (!shutdownRequested && reader.readLine (line))
+	{
+		QString request = QString::fromUtf8 (line).trimmed();
+		if (request.isEmpty()) continue;
+
+		if (!handleRequest (connectionFd, request))
+			break;
+	}
+}
+
+bool ExporterDaemon::handleRequest (int connectionFd, QString line)
+{
+	QTime timer;
+	timer.start();
+
+	QVariant request;
+	QString parseError;
+	QVariantMap requestObject, done;
+	done["type"] = "done";
+
+	if (!parseJson (line, request, parseError) || request.type() != QVariant::Map)
+	{
+		done["ok"] = false;
+		done["error"] = parseError.isEmpty() ? "A request must be a JSON object." : "Invalid request: " + parseError + ".";
+		done["elapsed_ms"] = timer.elapsed();
+		return sendLine (connectionFd, toJson (done));
+	}
+
+	requestObject = request.toMap();
+
+	// Files may have been edited between requests
+	FileReaderSingletone::instance().invalidateFileStatus();
+
+	QString command = requestObject.value ("command").toString();
+
+	QMap <QString, QString> arguments;
+	QVariantMap argumentsObject = requestObject.value ("arguments").toMap();
+	for (auto it = argumentsObject.begin(); it != argumentsObject.end(); it++)
+		arguments[it.key()] = it.value().toString();
+
+	bool ok = true, connectionLost = false;
+
+	// Sends a response line, tagged with the request id and the time elapsed so far
+	auto respond = [&] (QVariantMap response)
+	{
+		if (connectionLost) return;
+
+		response["elapsed_ms"] = timer.elapsed();
+		if (requestObject.contains ("id"))
+			response["id"] = requestObject["id"];
+
+		connectionLost = !sendLine (connectionFd, toJson (response));
+	};
+
+	{
+		StandardStreamsCapture capture;
+
+		// Diagnostics reach the client as they are produced, not when the command is over
+		capture.setSink ([&] (const QString& output, const QString& errors)
+		{
+			for (int stream = 0; stream < 2; stream++)
+			{
+				const QString& text = stream == 0 ? output : errors;
+				if (text.isEmpty()) continue;
+
+				QVariantMap response;
+				response["type"] = stream == 0 ? "output" : "errors";
+				response["text"] = text;
+				respond (response);
+			}
+		});
+
+		try
+		{
+			SceneryCommand cmd;
+			cmd.assign (command, arguments);
+
+			if (command.isEmpty())
+			{
+				qstderr << "A request must name a command." << endl;
+				ok = false;
+			}
+			else if (command == "unload")
+			{
+				QString dbName = cmd.getArgument ("db");
+				ok = executor->removeDatabase (dbName);
+				qstdout << (ok ? "Database '" + dbName + "' unloaded." : "No database '" + dbName + "' loaded.") << endl;
+			}
+			else if (command == "drop_deck")
+			{
+				QString deckName = cmd.getArgument ("deck");
+				ok = executor->removeDeck (deckName);
+				qstdout << (ok ? "Deck '" + deckName + "' dropped." : "No deck '" + deckName + "' found.") << endl;
+			}
+			else if (command == "reset")
+			{
+				executor.reset (new SceneryExecutor (""));
+				qstdout << "All databases, decks and settings dropped." << endl;
+			}
+			else if (command == "shutdown")
+			{
+				shutdownRequested = true;
+			}
+			else
+			{
+				executor->executeSingleCommand (cmd);
+
+				// A database with errors is reported, but not registered
+				if (command == "load")
+					ok = executor->hasDatabase (cmd.getArgument ("db", ""));
+			}
+		}
+		catch (HaltException&)
+		{
+			ok = false;
+		}
+
+		capture.setSink (StandardStreamsCapture::Sink());
+	}
+
+	qstdout << "Request '" << command << "' " << (ok ? "done" : "failed") << " in " << timer.elapsed() << " ms." << endl;
+
+	done["ok"] = ok;
+	respond (done);
+
+	return !connectionLost;
+}
+
+bool ExporterDaemon::runClient (QString socketPath, QTextStream& requests)
+{
+	int fd = connectTo (socketPath);
+	verify (fd >= 0, systemError ("Failed to connect to '" + socketPath + "'"));
+
+	LineReader reader (fd);
+	bool allSucceeded = true;
+
+	while (!requests.atEnd())
+	{
+		QString request = requests.readLine().trimmed();
+		if (request.isEmpty()) continue;
+
+		verify (sendLine (fd, request), systemError ("Failed to send a request to '" + socketPath + "'"));
+
+		for (;;)
+		{
+			QByteArray line;
+			verify (reader.readLine (line), "The daemon closed the connection.");
+
+			QVariant response;
+			QString parseError;
+			verify (parseJson (QString::fromUtf8 (line), response, parseError), "Invalid response from the daemon: " + parseError + ".");
+
+			QVariantMap responseObject = response.toMap();
+			QString type = responseObject.value ("type").toString();
+
+			if (type == "output")
+				qstdout << responseObject.value ("text").toString();
+			else if (type == "errors")
+				qstderr << responseObject.value ("text").toString();
+
+			if (type != "done")
+				continue;
+
+			bool ok = responseObject.value ("ok").toBool();
+			if (responseObject.contains ("error"))
+				qstderr << responseObject.value ("error").toString() << endl;
+
+			qstdout << (ok ? "Done" : "Failed") << " in " << responseObject.value ("elapsed_ms").toLongLong() << " ms." << endl;
+			allSucceeded = allSucceeded && ok;
+			break;
+		}
+	}
+
+	close (fd);
+	return allSucceeded;
+}
@@ -0,0 +1,43 @@
+#ifndef EXPORTER_DAEMON_H
+#define EXPORTER_DAEMON_H
+
+#include <memory>
+#include <QString>
+#include <QTextStream>
+
+using std::shared_ptr;
+
+class SceneryExecutor;
+
+// Keeps databases and decks in memory between requests arriving on a Unix domain socket.
+//
+// A request is one line with a JSON object: {"id": ..., "command": "load", "arguments": {"db": "...", "path": "..."}}.
+// Any scenery command is accepted, as well as "unload" (-db), "drop_deck" (-deck), "reset" and "shutdown".
+// The daemon answers with {"type": "output" | "errors", "text": ...} lines streaming the diagnostics of the
+// command as they are printed, followed by {"type": "done", "ok": ...}. Each line carries the "elapsed_ms"
+// since the request arrived, and echoes the "id" of the request.
+class ExporterDaemon
+{
+public :
+	ExporterDaemon (QString socketPath);
+	~ExporterDaemon();
+
+	// Serves connections one at a time until a client asks to shut down
+	void run();
+
+	// Sends the requests, one per line of the input, and prints the responses; returns false if any request failed
+	static bool runClient (QString socketPath, QTextStream& requests);
+
+private :
+	QString socketPath;
+	int listenFd;
+	shared_ptr <SceneryExecutor> executor;
+	bool shutdownRequested;
+
+	void serveConnection (int connectionFd);
+	bool handleRequest (int connectionFd, QString line);
+
+	ExporterDaemon (const ExporterDaemon&) = delete;
+};
+
+#endif // EXPORTER_DAEMON_H
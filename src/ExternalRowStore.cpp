@@ -0,0 +1,211 @@
+#include "ExternalRowStore.h"
+#include "Util.h"
+
+#include <QDataStream>
+#include <queue>
+#include <functional>
+
+namespace
+{
+	struct RunRecord
+	{
+		quint64 fingerprint, sequence;
+		QByteArray line;
+	};
+
+	// Memory taken by a record besides the line itself
+	const qint64 RUN_RECORD_OVERHEAD = 64;
+
+	typedef bool (*RunOrder) (const RunRecord&, const RunRecord&);
+	typedef std::vector < shared_ptr <QTemporaryFile> > Runs;
+
+	bool byFingerprint (const RunRecord& a, const RunRecord& b)
+	{
+		return a.fingerprint != b.fingerprint ? a.fingerprint < b.fingerprint : a.sequence < b.sequence;
+	}
+
+	bool bySequence (const RunRecord& a, const RunRecord& b)
+	{
+		return a.sequence < b.sequence;
+	}
+
+	// FNV-1a; equal fingerprints are always confirmed by comparing lines
+	quint64 rowFingerprint (const QByteArray& line)
+	{
+		quint64 hash = 14695981039346656037ULL;
+		for (char c: line)
+		{
+			hash ^= static_cast <unsigned char> (c);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	shared_ptr <QTemporaryFile> createTemporaryFile()
+	{
+		shared_ptr <QTemporaryFile> file (new QTemporaryFile);
+		verify (file->open(), "Failed to create a temporary file for deck rows.");
+		return file;
+	}
+
+	void writeRun (std::vector <RunRecord>& records, RunOrder order, Runs& runs)
+	{
+		if (records.empty())
+			return;
+
+		std::sort (records.begin(), records.end(), order);
+
+		shared_ptr <QTemporaryFile> run = createTemporaryFile();
+		QDataStream out (run.get());
+		for (const RunRecord& record: records)
+			out << record.fingerprint << record.sequence << record.line;
+
+		verify (out.status() == QDataStream::Ok && run->flush(), "Failed to write deck rows to '" + run->fileName() + "'.");
+
+		runs.push_back (run);
+		records.clear();
+	}
+
+	// K-way merge of sorted runs
+	void mergeRuns (const Runs& runs, RunOrder order, std::function <void (const RunRecord&)> consume)
+	{
+		struct RunReader
+		{
+			QDataStream in;
+			RunRecord current;
+
+			bool next()
+			{
+				if (in.atEnd())
+					return false;
+
+				in >> current.fingerprint >> current.sequence >> current.line;
+				verify (in.status() == QDataStream::Ok, "Failed to read back deck rows.");
+				return true;
+			}
+		};
+
+		std::vector < std::unique_ptr <RunReader> > readers;
+		for (const shared_ptr <QTemporaryFile>& run: runs)
+		{
+			verify (run->seek (0), "Failed to rewind deck rows in '" + run->fileName() + "'.");
+			readers.push_back (std::unique_ptr <RunReader> (new RunReader));
+			readers.back()->in.setDevice (run.get());
+		}
+
+		auto later = [&] (int a, int b) { return order (readers[b]->current, readers[a]->current); };
+		std::priority_queue <int, std::vector <int>, decltype (later)> heap (later);
+
+		for (int i = 0; i < (int) readers.size(); i++)
+			if (readers[i]->next())
+				heap.push (i);
+
+		while (!heap.empty())
+		{
+			int top = heap.top();
+			heap.pop();
+
+			consume (readers[top]->current);
+			if (readers[top]->next())
+				heap.push (top);
+		}
+	}
+}
+
+ExternalRowStore::ExternalRowStore (qint64 memoryBudget) :
+	memoryBudget (memoryBudget), rowLog (createTemporaryFile())
+{}
+
+void ExternalRowStore::appendRow (const std::map <int, QString>& row)
+{
+	QByteArray line = deckRowToLine (row).toUtf8();
+	line += '\n';
+	verify (rowLog->write (line) == line.size(), "Failed to write deck rows to '" + rowLog->fileName() + "'.");
+}
+
+void ExternalRowStore::writeRows (Utf8Writer& writer, int columnCount)
+{
+	verify (rowLog->flush() && rowLog->seek (0), "Failed to rewind deck rows in '" + rowLog->fileName() + "'.");
+
+	while (!rowLog->atEnd())
+	{
+		QByteArray line = rowLog->readLine();
+		if (line.endsWith ('\n'))
+			line.chop (1);
+
+		writeDeckRowLine (writer, line, columnCount);
+	}
+}
+
+void ExternalRowStore::removeDuplicates()
+{
+	// Half of the budget goes to the chunk being sorted, the rest is left to the merge buffers
+	qint64 chunkBudget = qMax <qint64> (memoryBudget / 2, 1 << 20), chunkBytes = 0;
+	std::vector <RunRecord> chunk;
+
+	// Split the rows into runs sorted by fingerprint
+	Runs fingerprintRuns;
+	verify (rowLog->flush() && rowLog->seek (0), "Failed to rewind deck rows in '" + rowLog->fileName() + "'.");
+
+	for (quint64 sequence = 0; !rowLog->atEnd(); sequence++)
+	{
+		RunRecord record;
+		record.line = rowLog->readLine();
+		if (record.line.endsWith ('\n'))
+			record.line.chop (1);
+		record.fingerprint = rowFingerprint (record.line);
+		record.sequence = sequence;
+
+		chunk.push_back (record);
+		chunkBytes += record.line.size() + RUN_RECORD_OVERHEAD;
+
+		if (chunkBytes >= chunkBudget)
+		{
+			writeRun (chunk, byFingerprint, fingerprintRuns);
+			chunkBytes = 0;
+		}
+	}
+	writeRun (chunk, byFingerprint, fingerprintRuns);
+	chunkBytes = 0;
+
+	// Equal rows are adjacent now, the first of them has the smallest sequence number
+	Runs survivorRuns;
+	bool groupStarted = false;
+	quint64 groupFingerprint = 0;
+	QList <QByteArray> groupLines;
+
+	mergeRuns (fingerprintRuns, byFingerprint, [&] (const RunRecord& record)
+	{
+		if (!groupStarted || record.fingerprint != groupFingerprint)
+		{
+			groupStarted = true;
+			groupFingerprint = record.fingerprint;
+			groupLines.clear();
+		}
+
+		if (groupLines.contains (record.line))
+			return;
+		groupLines.push_back (record.line);
+
+		chunk.push_back (record);
+		chunkBytes += record.line.size() + RUN_RECORD_OVERHEAD;
+
+		if (chunkBytes >= chunkBudget)
+		{
+			writeRun (chunk, bySequence, survivorRuns);
+			chunkBytes = 0;
+		}
+	});
+	writeRun (chunk, bySequence, survivorRuns);
+	fingerprintRuns.clear();
+
+	// Restore the submission order
+	shared_ptr <QTemporaryFile> deduplicatedLog = createTemporaryFile();
+	mergeRuns (survivorRuns, bySequence, [&] (const RunRecord& record)
+	{
+		verify (deduplicatedLog->write (record.line) == record.line.size() && deduplicatedLog->putChar ('\n'),
+		        "Failed to write deck rows to '" + deduplicatedLog->fileName() + "'.");
+	});
+
+	rowLog = deduplicatedLog;
+}
@@ -0,0 +1,26 @@
+#ifndef EXTERNAL_ROW_STORE_H
+#define EXTERNAL_ROW_STORE_H
+
+#include "DatabaseExporter.h"
+
+#include <memory>
+#include <QTemporaryFile>
+
+// Deck rows kept on disk for decks larger than their memory budget. Rows are stored in submission order;
+// duplicates are removed by an external merge sort over row fingerprints which keeps first occurrences.
+class ExternalRowStore
+{
+public :
+	ExternalRowStore (qint64 memoryBudget);
+
+	void appendRow (const std::map <int, QString>& row);
+	void writeRows (Utf8Writer& writer, int columnCount);
+
+	void removeDuplicates();
+
+private :
+	qint64 memoryBudget;
+	shared_ptr <QTemporaryFile> rowLog;
+};
+
+#endif // EXTERNAL_ROW_STORE_H
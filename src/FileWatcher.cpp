@@ -0,0 +1,113 @@
+#include "FileWatcher.h"
+#include "Util.h"
+
+#include <QFileInfo>
+#include <QDir>
+
+#ifndef Q_OS_LINUX
+#error This platform is not supported. Add more cases or test if the existing code works.
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace
+{
+	const uint32_t WATCHED_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE;
+}
+
+FileWatcher::FileWatcher()
+{
+	inotifyFd = inotify_init1 (IN_CLOEXEC);
+	verify (inotifyFd >= 0, "Failed to initialize inotify: " + QString::fromLocal8Bit (strerror (errno)));
+}
+
+FileWatcher::~FileWatcher()
+{
+	close (inotifyFd);
+}
+
+void FileWatcher::setWatchedFiles (QSet <QString> absolutePaths)
+{
+	// Events name files relative to the directory, so paths are compared in the clean form
+	QSet <QString> directories;
+	watchedFiles.clear();
+	for (QString path: absolutePaths)
+	{
+		QString cleanPath = QDir::cleanPath (path);
+		watchedFiles[cleanPath] = path;
+		directories.insert (QFileInfo (cleanPath).absolutePath());
+	}
+
+	for (auto it = watchedDirectories.begin(); it != watchedDirectories.end();)
+	{
+		if (directories.contains (it.value()))
+		{
+			directories.remove (it.value());
+			it++;
+			continue;
+		}
+
+		inotify_rm_watch (inotifyFd, it.key());
+		it = watchedDirectories.erase (it);
+	}
+
+	for (QString directory: directories)
+	{
+		int watch = inotify_add_watch (inotifyFd, directory.toLocal8Bit().constData(), WATCHED_EVENTS);
+		if (watch < 0)
+		{
+			qstderr << "Warning: failed to watch directory '" << directory << "': " << QString::fromLocal8Bit (strerror (errno)) << endl;
+			continue;
+		}
+
+		watchedDirectories[watch] = directory;
+	}
+}
+
+bool FileWatcher::readEvents (int timeoutMilliseconds, QSet <QString>& changed)
+{
+	pollfd descriptor = { inotifyFd, POLLIN, 0 };
+	int ready = poll (&descriptor, 1, timeoutMilliseconds);
+	if (ready < 0 && errno == EINTR)
+		return true;
+
+	verify (ready >= 0, "Failed to wait for file changes: " + QString::fromLocal8Bit (strerror (errno)));
+	if (ready == 0)
+		return false;
+
+	alignas (inotify_event) char buffer[64 * 1024];
+	ssize_t length = read (inotifyFd, buffer, sizeof buffer);
+	verify (length > 0 || errno == EINTR, "Failed to read file changes: " + QString::fromLocal8Bit (strerror (errno)));
+
+	for (ssize_t offset = 0; offset < length;)
+	{
+		const inotify_event* event = reinterpret_cast <const inotify_event*> (buffer + offset);
+		offset += static_cast <ssize_t> (sizeof (inotify_event) + event->len);
+
+		if (event->len == 0 || watchedDirectories.count (event->wd) == 0)
+			continue;
+
+		QString path = QDir::cleanPath (watchedDirectories[event->wd] + "/" + QString::fromLocal8Bit (event->name));
+		if (watchedFiles.count (path) > 0)
+			changed.insert (watchedFiles[path]);
+	}
+
+	return true;
+}
+
+QSet <QString> FileWatcher::waitForChanges (int settleMilliseconds)
+{
+	QSet <QString> changed;
+
+	while (changed.isEmpty())
+		readEvents (-1, changed);
+
+	while (readEvents (settleMilliseconds, changed))
+		;
+
+	return changed;
+}
@@ -0,0 +1,30 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <QString>
+#include <QSet>
+#include <QMap>
+
+// Reports changes of a set of files through inotify. Directories of the files are watched rather than
+// the files themselves, so that editors which save by renaming a new file over the old one are noticed too.
+class FileWatcher
+{
+public :
+	FileWatcher();
+	~FileWatcher();
+
+	void setWatchedFiles (QSet <QString> absolutePaths);
+
+	// Blocks until a watched file changes. Changes following each other within the settle time
+	// (an editor writing a backup and then the file) are reported together.
+	QSet <QString> waitForChanges (int settleMilliseconds = 50);
+
+private :
+	int inotifyFd;
+	QMap <int, QString> watchedDirectories;
+	QMap <QString, QString> watchedFiles;
+
+	bool readEvents (int timeoutMilliseconds, QSet <QString>& changed);
+};
+
+#endif // FILE_WATCHER_H
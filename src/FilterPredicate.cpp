@@ -0,0 +1,240 @@
+#include "FilterPredicate.h"
+#include "FlashcardsDatabase.h"
+#include "Util.h"
+
+class FilterExpressionParser
+{
+public :
+	FilterExpressionParser (QString expression) :
+		expression (expression), position (0)
+	{}
+
+	shared_ptr <FilterPredicate> parse (QString& error)
+	{
+		shared_ptr <FilterPredicate> predicate = parseOr();
+		skipSpaces();
+
+		if (predicate && position != expression.size())
+			predicate = fail ("unexpected '" + expression.mid (position, 1) + "'");
+
+		if (!predicate)
+			error = errorMessage + " at offset " + QString::number (position) + " of '" + expression + "'";
+
+		return predicate;
+	}
+
+private :
+	QString expression;
+	int position;
+	QString errorMessage;
+
+	shared_ptr <FilterPredicate> fail (QString message)
+	{
+		if (errorMessage.isEmpty())
+			errorMessage = message;
+		return shared_ptr <FilterPredicate>();
+	}
+
+	void skipSpaces()
+	{
+		while (position < expression.size() && expression[position].isSpace())
+			position++;
+	}
+
+	bool consume (QChar c)
+	{
+		skipSpaces();
+		if (position >= expression.size() || expression[position] != c)
+			return false;
+
+		position++;
+		return true;
+	}
+
+	static shared_ptr <FilterPredicate> combine (FilterPredicate::Kind kind, shared_ptr <FilterPredicate> left, shared_ptr <FilterPredicate> right)
+	{
+		shared_ptr <FilterPredicate> predicate (new FilterPredicate);
+		predicate->kind = kind;
+		predicate->left = left;
+		predicate->right = right;
+		return predicate;
+	}
+
+	shared_ptr <FilterPredicate> parseOr()
+	{
+		shared_ptr <FilterPredicate> result = parseAnd();
+		while (result && consume ('|'))
+		{
+			shared_ptr <FilterPredicate> right = parseAnd();
+			result = right ? combine (FilterPredicate::Kind::OR, result, right) : right;
+		}
+		return result;
+	}
+
+	shared_ptr <FilterPredicate> parseAnd()
+	{
+		shared_ptr <FilterPredicate> result = parseNot();
+		while (result && consume ('&'))
+		{
+			shared_ptr <FilterPredicate> right = parseNot();
+			result = right ? combine (FilterPredicate::Kind::AND, result, right) : right;
+		}
+		return result;
+	}
+
+	shared_ptr <FilterPredicate> parseNot()
+	{
+		if (consume ('!'))
+		{
+			shared_ptr <FilterPredicate> operand = parseNot();
+			return operand ? combine (FilterPredicate::Kind::NOT, operand, shared_ptr <FilterPredicate>()) : operand;
+		}
+
+		if (consume ('('))
+		{
+			shared_ptr <FilterPredicate> inner = parseOr();
+			if (inner && !consume (')'))
+				return fail ("')' expected");
+			return inner;
+		}
+
+		return parseOperand();
+	}
+
+	shared_ptr <FilterPredicate> parseOperand()
+	{
+		skipSpaces();
+		int begin = position;
+		while (position < expression.size() && !expression[position].isSpace() && !QString ("!&|()").contains (expression[position]))
+			position++;
+
+		QString token = expression.mid (begin, position - begin);
+		if (token.isEmpty())
+			return fail ("operand expected");
+
+		shared_ptr <FilterPredicate> predicate (new FilterPredicate);
+
+		if (token == "third")
+		{
+			predicate->kind = FilterPredicate::Kind::THIRD_SIDE;
+		}
+		else if (token.startsWith ("tag:") && token.length() > 4)
+		{
+			predicate->kind = FilterPredicate::Kind::TAG;
+			predicate->operand = token.mid (4);
+
+			if (!sharedRegExp (predicate->operand, Qt::CaseSensitive, QRegExp::Wildcard).isValid())
+				return fail ("invalid tag pattern '" + predicate->operand + "'");
+		}
+		else if (token == "type:event" || token == "type:term" || token == "type:question")
+		{
+			predicate->kind = FilterPredicate::Kind::TYPE;
+			predicate->operand = token.mid (5);
+		}
+		else
+		{
+			position = begin;
+			return fail ("unknown operand '" + token + "' (expected tag:pattern, type:event, type:term, type:question or third)");
+		}
+
+		return predicate;
+	}
+};
+
+shared_ptr <FilterPredicate> FilterPredicate::compile (QString expression, QString& error)
+{
+	FilterExpressionParser parser (expression);
+	return parser.parse (error);
+}
+
+EntryBitmap FilterPredicate::evaluate (const FlashcardsDatabase& database) const
+{
+	int numEntries = database.entryCount();
+
+	switch (kind)
+	{
+		case Kind::TAG:
+		{
+			// Patterns are matched against the distinct tags only
+			QRegExp tagMatcher = sharedRegExp (operand, Qt::CaseSensitive, QRegExp::Wildcard);
+			EntryBitmap result (numEntries);
+
+			for (int tagId = 0; tagId < database.tagNames.size(); tagId++)
+				if (tagMatcher.exactMatch (database.tagNames[tagId]))
+					result |= database.tagBitmaps[tagId];
+
+			return result;
+		}
+
+		case Kind::TYPE:
+			return database.typeBitmaps.value (operand, EntryBitmap (numEntries));
+
+		case Kind::THIRD_SIDE:
+			return database.thirdSideBitmap;
+
+		case Kind::NOT:
+			return ~left->evaluate (database);
+
+		case Kind::AND:
+		{
+			EntryBitmap result = left->evaluate (database);
+			result &= right->evaluate (database);
+			return result;
+		}
+
+		case Kind::OR:
+		{
+			EntryBitmap result = left->evaluate (database);
+			result |= right->evaluate (database);
+			return result;
+		}
+
+		default:
+			failure ("Unknown filter predicate kind.");
+			return EntryBitmap();
+	}
+}
+
+bool FilterPredicate::getTagBound (QStringList& tagPatterns) const
+{
+	switch (kind)
+	{
+		case Kind::TAG:
+			tagPatterns << operand;
+			return true;
+
+		case Kind::AND:
+		{
+			// Either side bounds the intersection
+			QStringList leftPatterns, rightPatterns;
+			bool leftBound = left->getTagBound (leftPatterns), rightBound = right->getTagBound (rightPatterns);
+
+			if (leftBound && (!rightBound || leftPatterns.size() <= rightPatterns.size()))
+				tagPatterns << leftPatterns;
+			else if (rightBound)
+				tagPatterns << rightPatterns;
+
+			return leftBound || rightBound;
+		}
+
+		case Kind::OR:
+		{
+			QStringList leftPatterns, rightPatterns;
+			if (!left->getTagBound (leftPatterns) || !right->getTagBound (rightPatterns))
+				return false;
+
+			tagPatterns << leftPatterns << rightPatterns;
+			return true;
+		}
+
+		// Entries of any tag may match
+		case Kind::TYPE:
+		case Kind::THIRD_SIDE:
+		case Kind::NOT:
+			return false;
+
+		default:
+			failure ("Unknown filter predicate kind.");
+			return false;
+	}
+}
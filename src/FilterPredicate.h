@@ -0,0 +1,48 @@
+#ifndef FILTER_PREDICATE_H
+#define FILTER_PREDICATE_H
+
+#include <memory>
+#include <QString>
+#include <QStringList>
+
+#include "EntryBitmap.h"
+
+using std::shared_ptr;
+
+class FlashcardsDatabase;
+
+// A compiled filter expression, evaluated against the indexes of a database rather than its entries.
+//
+// Operands are "tag:pattern" (wildcards as in shell globs, so "tag:war-*" selects a prefix), "type:event",
+// "type:term", "type:question" and "third" (cards with a third side). Operators are '!', '&' and '|' in the
+// order of precedence, with parentheses for grouping. Spaces are optional, e.g. "tag:war-*&!type:term".
+class FilterPredicate
+{
+public :
+	// Returns null and describes the problem if the expression is malformed
+	static shared_ptr <FilterPredicate> compile (QString expression, QString& error);
+
+	EntryBitmap evaluate (const FlashcardsDatabase& database) const;
+
+	// Tag patterns that every selected entry matches one of; false if the expression can select any tag
+	bool getTagBound (QStringList& tagPatterns) const;
+
+private :
+	enum class Kind
+	{
+		TAG,
+		TYPE,
+		THIRD_SIDE,
+		NOT,
+		AND,
+		OR
+	};
+
+	Kind kind;
+	QString operand;
+	shared_ptr <FilterPredicate> left, right;
+
+	friend class FilterExpressionParser;
+};
+
+#endif // FILTER_PREDICATE_H
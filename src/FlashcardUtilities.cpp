@@ -1,5 +1,7 @@
 #include "FlashcardUtilities.h"
 
+#include <QStringList>
+
 QTextStream& operator<< (QTextStream& stream, const SimpleDate& date)
 {
     if (!date.isParsed())
@@ -35,6 +37,59 @@ QTextStream& operator<< (QTextStream& stream, const ComplexDate& date)
     return stream;
 }
 
+namespace
+{
+    // The year takes the bits above the 4 of the month and the 5 of the day
+    const int MAX_KEY_YEAR = (1 << 23) - 1;
+}
+
+quint32 SimpleDate::toKey (bool upperBound) const
+{
+    // Unspecified and unparsed parts are negative. A part out of range would spill into the field
+    // above it, so it is left out like an unspecified one and the key covers the whole month or year.
+    bool monthKnown = month >= 1 && month <= 12, dayKnown = monthKnown && day >= 1 && day <= 31;
+    
+    quint32 keyYear = year < 0 ? 0 : quint32 (qMin (year, MAX_KEY_YEAR));
+    quint32 keyMonth = monthKnown ? quint32 (month) : (upperBound ? 15 : 0);
+    quint32 keyDay = dayKnown ? quint32 (day) : (upperBound ? 31 : 0);
+    
+    return (keyYear << 9) | (keyMonth << 5) | keyDay;
+}
+
+bool SimpleDate::parse (QString string, SimpleDate& date)
+{
+    QStringList parts = string.trimmed().split ('.');
+    if (parts.size() > 3)
+        return false;
+    
+    QVector <int> numbers;
+    for (QString part: parts)
+    {
+        bool parsed = false;
+        numbers.push_back (part.toInt (&parsed));
+        if (!parsed || numbers.last() < 0)
+            return false;
+    }
+    
+    date = SimpleDate();
+    date.year = numbers.last();
+    if (numbers.size() >= 2) date.month = numbers[numbers.size() - 2];
+    if (numbers.size() == 3) date.day = numbers[0];
+    
+    return (date.month == SIMPLE_DATE_UNSPECIFIED || (date.month >= 1 && date.month <= 12)) &&
+           (date.day == SIMPLE_DATE_UNSPECIFIED || (date.day >= 1 && date.day <= 31));
+}
+
+void ComplexDate::toKeys (quint32& beginKey, quint32& endKey) const
+{
+    beginKey = begin.toKey (false);
+    endKey = end.isSpecified() ? end.toKey (true) : begin.toKey (true);
+    
+    // A reversed interval is a typo in the database; treat it as its begin date
+    if (endKey < beginKey)
+        endKey = begin.toKey (true);
+}
+
 QString ComplexDate::toString()
 {
     QString str = "";
@@ -43,6 +98,31 @@ QString ComplexDate::toString()
     return str;
 }
 
+CardText& CardText::operator+= (const QString& fragment)
+{
+    if (!fragment.isEmpty())
+        fragments.push_back (fragment);
+    return *this;
+}
+
+QString CardText::toString() const
+{
+    // A single fragment is handed out shared
+    if (fragments.size() <= 1)
+        return fragments.isEmpty() ? QString ("") : fragments.first();
+    
+    int length = 0;
+    for (const QString& fragment: fragments)
+        length += fragment.size();
+    
+    QString text;
+    text.reserve (length);
+    for (const QString& fragment: fragments)
+        text += fragment;
+    
+    return text;
+}
+
 bool isEndingSymbol (QChar c)
 {
     return c == '.' || c == '?' || c == '!' || c == ')';
@@ -50,6 +130,9 @@ bool isEndingSymbol (QChar c)
 
 QString replaceEscapes (QString s)
 {
+    if (!s.contains ('\\'))
+        return s;
+    
     return s.replace ("\\n", "\n").replace ('\\', "");
 }
 
@@ -61,4 +144,9 @@ bool SimpleDate::isParsed() const
 bool SimpleDate::isSpecified() const
 {
     return year != SIMPLE_DATE_UNSPECIFIED;
+}
+
+bool SimpleDate::isInRange() const
+{
+    return (month < 0 || (month >= 1 && month <= 12)) && (day < 0 || (day >= 1 && day <= 31));
 }
\ No newline at end of file
@@ -20,6 +20,16 @@ struct SimpleDate
     
     bool isParsed() const;
     bool isSpecified() const;
+    
+    // False if the month isn't within 1..12 or the day isn't within 1..31
+    bool isInRange() const;
+    
+    // Packs the date into an integer ordered like the dates; unspecified parts become the lowest
+    // or the highest possible value, so that a year or month key covers the whole period
+    quint32 toKey (bool upperBound) const;
+    
+    // Accepts "year", "month.year" and "day.month.year" with numeric months
+    static bool parse (QString string, SimpleDate& date);
 };
 
 QTextStream& operator<< (QTextStream& stream, const SimpleDate& date);
@@ -29,10 +39,40 @@ struct ComplexDate
     SimpleDate begin, end;
     
     QString toString();
+    
+    // Bounds of the covered period as date keys; a single date covers its whole day, month or year
+    void toKeys (quint32& beginKey, quint32& endKey) const;
 };
 
 QTextStream& operator<< (QTextStream& stream, const ComplexDate& date);
 
+// Text of a card side kept as the fragments it was made of. Fragments common to many cards (preambles,
+// rule references) are Qt strings sharing their data, so each of them is stored once however many cards
+// use it; the text is only put together when it is exported.
+class CardText
+{
+public :
+    CardText()
+    {}
+    
+    CardText (const QString& text)
+    {
+        *this += text;
+    }
+    
+    CardText& operator+= (const QString& fragment);
+    
+    bool isEmpty() const
+    {
+        return fragments.isEmpty();
+    }
+    
+    QString toString() const;
+    
+private :
+    QVector <QString> fragments;
+};
+
 bool isEndingSymbol (QChar c);
 QString replaceEscapes (QString s);
 
@@ -1,5 +1,8 @@
 #include "FlashcardsDatabase.h"
 
+#include <QHash>
+#include <QMutexLocker>
+
 SimpleFlashcard::SimpleFlashcard (QString tag, VariableStackState variableStack) :
     VariableStackStateHolder (variableStack), tag (tag)
 {}
@@ -8,3 +11,122 @@ QString SimpleFlashcard::getVariableValue (QString variableName)
 {
     return variableStack.getVariableValue (variableName);
 }
+
+shared_ptr <FlashcardsDatabase> FlashcardsDatabase::createView (shared_ptr <FlashcardsDatabase> source, QVector <int> indices)
+{
+	shared_ptr <FlashcardsDatabase> view (new FlashcardsDatabase (source->variableStack));
+
+	// Views of views select from the parsed database directly
+	if (source->viewedDatabase)
+	{
+		for (int& index: indices)
+			index = source->viewedIndices[index];
+		source = source->viewedDatabase;
+	}
+
+	view->viewedDatabase = source;
+	view->viewedIndices = indices;
+	return view;
+}
+
+int FlashcardsDatabase::entryCount() const
+{
+	return viewedDatabase ? viewedIndices.size() : entries.size();
+}
+
+const shared_ptr <SimpleFlashcard>& FlashcardsDatabase::entry (int index) const
+{
+	return viewedDatabase ? viewedDatabase->entries[viewedIndices[index]] : entries[index];
+}
+
+void FlashcardsDatabase::buildIndexes()
+{
+	int numEntries = entryCount();
+
+	tagNames.clear();
+	tagBitmaps.clear();
+	typeBitmaps.clear();
+	entryTagIds.resize (numEntries);
+	thirdSideBitmap = EntryBitmap (numEntries);
+	entryDateBegins.fill (0, numEntries);
+	entryDateEnds.fill (0, numEntries);
+	datedBitmap = EntryBitmap (numEntries);
+
+	if (viewedDatabase)
+	{
+		// Everything is known from the indexes of the viewed database, entries aren't even touched
+		QVector <int> viewTagIds (viewedDatabase->tagNames.size(), -1);
+
+		for (int i = 0; i < numEntries; i++)
+		{
+			int viewedIndex = viewedIndices[i], viewedTagId = viewedDatabase->entryTagIds[viewedIndex];
+			if (viewTagIds[viewedTagId] == -1)
+			{
+				viewTagIds[viewedTagId] = tagNames.size();
+				tagNames << viewedDatabase->tagNames[viewedTagId];
+				tagBitmaps.push_back (EntryBitmap (numEntries));
+			}
+
+			entryTagIds[i] = viewTagIds[viewedTagId];
+			tagBitmaps[entryTagIds[i]].set (i);
+
+			for (auto it = viewedDatabase->typeBitmaps.begin(); it != viewedDatabase->typeBitmaps.end(); it++)
+				if (it.value().test (viewedIndex))
+				{
+					if (typeBitmaps.count (it.key()) == 0)
+						typeBitmaps[it.key()] = EntryBitmap (numEntries);
+					typeBitmaps[it.key()].set (i);
+				}
+
+			if (viewedDatabase->thirdSideBitmap.test (viewedIndex))
+				thirdSideBitmap.set (i);
+
+			entryDateBegins[i] = viewedDatabase->entryDateBegins[viewedIndex];
+			entryDateEnds[i] = viewedDatabase->entryDateEnds[viewedIndex];
+			if (viewedDatabase->datedBitmap.test (viewedIndex))
+				datedBitmap.set (i);
+		}
+
+		return;
+	}
+
+	QHash <QString, int> tagIds;
+
+	for (int i = 0; i < numEntries; i++)
+	{
+		QString tag = entries[i]->getTag();
+		auto it = tagIds.find (tag);
+		if (it == tagIds.end())
+		{
+			it = tagIds.insert (tag, tagNames.size());
+			tagNames << tag;
+			tagBitmaps.push_back (EntryBitmap (numEntries));
+		}
+
+		entryTagIds[i] = it.value();
+		tagBitmaps[it.value()].set (i);
+
+		QString typeName = entries[i]->getTypeName();
+		if (typeBitmaps.count (typeName) == 0)
+			typeBitmaps[typeName] = EntryBitmap (numEntries);
+		typeBitmaps[typeName].set (i);
+
+		if (entries[i]->thirdSidePresent())
+			thirdSideBitmap.set (i);
+
+		if (entries[i]->getDateInterval (entryDateBegins[i], entryDateEnds[i]))
+			datedBitmap.set (i);
+	}
+}
+
+const DateIntervalIndex& FlashcardsDatabase::getDateIndex()
+{
+	QMutexLocker locker (&dateIndexMutex);
+	if (!dateIndexBuilt)
+	{
+		dateIndex.build (entryDateBegins, entryDateEnds, datedBitmap);
+		dateIndexBuilt = true;
+	}
+
+	return dateIndex;
+}
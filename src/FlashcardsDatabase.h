@@ -7,9 +7,13 @@
 #include <QMap>
 #include <QStringList>
 #include <QFileInfo>
+#include <QSet>
+#include <QMutex>
 
 #include "Util.h"
 #include "VariableStack.h"
+#include "EntryBitmap.h"
+#include "DateIntervalIndex.h"
 
 using std::shared_ptr;
 
@@ -26,6 +30,12 @@ public :
     virtual QString getFrontSide() = 0;
     virtual QString getBackSide() = 0;
     
+    // Kind of the card, as named in filter expressions ("event", "term", "question")
+    virtual QString getTypeName() = 0;
+    
+    // Period the card is about, as date keys (see SimpleDate::toKey); false for undated cards
+    virtual bool getDateInterval (quint32&, quint32&) { return false; }
+    
     virtual bool thirdSidePresent() { return false; }
     virtual QString getThirdSide() { return nullptr; }
     
@@ -52,14 +62,50 @@ class FlashcardsDatabase
 {
 public :
 	QVector <FileLocationMessage> messages;
+
+	// Entries a parsed database owns; a view leaves it empty, see entry()
 	QVector < shared_ptr <SimpleFlashcard> > entries;
 
 	shared_ptr <VariableStack> variableStack;
 	QVector < QPair <QString, QString> > replacements;
 
+	// Absolute paths of every file the database was parsed from, images included
+	QSet <QString> sourceFiles;
+
+	// Indexes built when the database is registered: entryTagIds[i] indexes tagNames and tagBitmaps
+	QStringList tagNames;
+	QVector <int> entryTagIds;
+	QVector <EntryBitmap> tagBitmaps;
+	QMap <QString, EntryBitmap> typeBitmaps;
+	EntryBitmap thirdSideBitmap;
+
+	// Date keys of the entries (see SimpleDate::toKey), meaningful where datedBitmap is set
+	QVector <quint32> entryDateBegins, entryDateEnds;
+	EntryBitmap datedBitmap;
+
     FlashcardsDatabase (shared_ptr <VariableStack> variableStack) :
 		variableStack (variableStack)
 	{}
+
+	// A database selecting entries of the source by index, sharing them instead of copying. Indexes of a view
+	// are derived from the ones of the source, so the source must be registered already.
+	static shared_ptr <FlashcardsDatabase> createView (shared_ptr <FlashcardsDatabase> source, QVector <int> indices);
+
+	int entryCount() const;
+	const shared_ptr <SimpleFlashcard>& entry (int index) const;
+
+	void buildIndexes();
+
+	// Built on first use, as only date filters need it
+	const DateIntervalIndex& getDateIndex();
+
+private :
+	shared_ptr <FlashcardsDatabase> viewedDatabase;
+	QVector <int> viewedIndices;
+
+	QMutex dateIndexMutex;
+	bool dateIndexBuilt = false;
+	DateIntervalIndex dateIndex;
 };
 
 #endif // HISTORICAL_DATABASE_H
\ No newline at end of file
@@ -31,6 +31,35 @@ void DatabaseParser::registerBlockParser (shared_ptr <BlockParser> parser, QStri
     blockParsers[name] = parser;
 }
 
+void DatabaseParser::setParsedTags (ParsedTags tags)
+{
+    parsedTags = tags;
+    tagParsed.clear();
+}
+
+bool DatabaseParser::isTagParsed (QString tag)
+{
+    if (parsedTags.isEmpty())
+        return true;
+    
+    if (!tagParsed.contains (tag))
+    {
+        // Exact tags come from filter -tag, which doesn't treat '*' or '?' specially
+        bool matches = parsedTags.exactTags.contains (tag);
+        for (QString pattern: parsedTags.patterns)
+        {
+            if (matches)
+                break;
+            
+            matches = sharedRegExp (pattern, Qt::CaseSensitive, QRegExp::Wildcard).exactMatch (tag);
+        }
+        
+        tagParsed[tag] = matches;
+    }
+    
+    return tagParsed[tag];
+}
+
 #include "HistoricalFlashcards.h"
 #include "QuestionFlashcard.h"
 
@@ -39,6 +68,9 @@ void DatabaseParser::processCurrentBlock()
     assert (!currentBlock.isEmpty());
     QString firstLine = currentBlock[0];
     assert (!firstLine.isEmpty());
+    
+    // Entries capture the variables they were made with
+    effect.replayable = false;
 
     // Some constructions can be detected easily
     if (currentDatabase->variableStack->currentState().getVariableValue ("disableTags").isNull() && firstLine[0] == '[')
@@ -63,6 +95,7 @@ void DatabaseParser::processCurrentBlock()
     
     QString parsersList = currentDatabase->variableStack->currentState().getVariableValue ("parsers");
     QStringList parsers = parsersList.split (",", QString::SkipEmptyParts);
+    bool skipped = !isTagParsed (currentEntryTag);
     
     for (QString parserName: parsers)
     {
@@ -73,16 +106,24 @@ void DatabaseParser::processCurrentBlock()
         if (!blockParser->acceptsBlock (currentBlock))
             continue;
         
-        blockParser->parseBlock (currentBlock);
+        if (skipped)
+            blockParser->skipBlock (currentBlock);
+        else
+            blockParser->parseBlock (currentBlock);
         return;
     }
     
+    // Nobody would see the error in a block that isn't exported
+    if (skipped)
+        return;
+    
     blockParseError (0, "No parser ('" + parsersList + "') accepts found block.");
 }
 
 void DatabaseParser::processDirective (QString directive, shared_ptr <FlashcardsDatabase> database)
 {
     const QString includeDirectivePrefix = "#include ",
+                  includeOnceDirectivePrefix = "#include_once ",
                   pushDirectivePrefix = "#push ",
                   popDirectivePrefix = "#pop",
                   imageDirectivePrefix = "#image ",
@@ -91,11 +132,11 @@ void DatabaseParser::processDirective (QString directive, shared_ptr <Flashcards
 
     if (directive.startsWith (includeDirectivePrefix))
     {
-        QString includePath = directive.right (directive.length() - includeDirectivePrefix.length());
-        shared_ptr <DatabaseParser> subParser (new DatabaseParser);
-        subParser->blockParsers = blockParsers;
-        QPair <QString, QString> contentsNamePair = FileReaderSingletone::instance().readContents (includePath, DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
-        subParser->parseDatabase (contentsNamePair.second, contentsNamePair.first, database, nullptr);
+        processInclude (directive.right (directive.length() - includeDirectivePrefix.length()), false, database);
+    }
+    else if (directive.startsWith (includeOnceDirectivePrefix))
+    {
+        processInclude (directive.right (directive.length() - includeOnceDirectivePrefix.length()), true, database);
     }
     else if (directive.startsWith (pushDirectivePrefix))
     {
@@ -126,20 +167,26 @@ void DatabaseParser::processDirective (QString directive, shared_ptr <Flashcards
 
         //qstderr << "Push variable '" << name << "' with value '" << value << "'" << endl;
         currentDatabase->variableStack->pushVariable (name, currentDatabase->variableStack->getVariableExpansion (value));
+        recordOperation (IncludeEffect::Kind::VARIABLE, name, value);
     }
     else if (directive.startsWith (popDirectivePrefix) && !directive.startsWith (popReplacementPrefix))
     {
         directive = directive.right (directive.length() - popDirectivePrefix.length()).trimmed();
 
+        // Whatever is popped depends on the includer
+        effect.replayable = false;
+        
         if (!currentDatabase->variableStack->popVariable (directive))
             blockParseError (0, directive.isEmpty() ? "Failed to pop variable: the stack is empty." : "Failed to pop variable '" + directive + "': not found on stack.");
     }
     else if (directive.startsWith (imageDirectivePrefix))
     {
         directive = directive.right (directive.length() - imageDirectivePrefix.length()).trimmed();
-        directive = FileReaderSingletone::instance().getAbsolutePath (directive, DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+        directive = FileReaderSingletone::instance().getAbsolutePath (directive, DATABASE_INCLUDE_DIRECTORIES_CONTEXT, searchPath);
+        currentDatabase->sourceFiles.insert (QFileInfo (directive).absoluteFilePath());
 
         currentDatabase->variableStack->pushVariable ("image", directive);
+        recordOperation (IncludeEffect::Kind::IMAGE, "image", directive);
     }
     else if (directive.startsWith (pushReplacementPrefix))
     {
@@ -161,9 +208,12 @@ void DatabaseParser::processDirective (QString directive, shared_ptr <Flashcards
             blockParseError (0, "Non-empty last part of a '" + pushReplacementPrefix + "' directive: '" + parts[2] + "'.");
         
         currentDatabase->replacements.push_back (QPair <QString, QString> (parts[0], currentDatabase->variableStack->getVariableExpansion (parts[1])));
+        recordOperation (IncludeEffect::Kind::REPLACEMENT, parts[0], parts[1]);
     }
     else if (directive.startsWith (popReplacementPrefix))
     {
+        effect.replayable = false;
+        
         if (directive != popReplacementPrefix)
             blockParseError (0, "Directive '" + popReplacementPrefix + "' has no parameters.");
 
@@ -174,20 +224,130 @@ void DatabaseParser::processDirective (QString directive, shared_ptr <Flashcards
     }
     else
     {
+        effect.replayable = false;
         blockParseError (0, "Unknown directive: '" + directive + "'.");
     }
 }
 
-shared_ptr <FlashcardsDatabase> DatabaseParser::parseDatabase (QString fileName, const QString& fileContents, shared_ptr <FlashcardsDatabase> appendTo, shared_ptr <VariableStack> variableStack)
+void DatabaseParser::processInclude (QString includePath, bool once, shared_ptr <FlashcardsDatabase> database)
+{
+    QPair <QString, QString> contentsNamePair = includePrefetcher->readContents (includePath);
+    QString absolutePath = QFileInfo (contentsNamePair.second).absoluteFilePath();
+    
+    int cycleStart = includeGraph->chain.indexOf (absolutePath);
+    if (cycleStart != -1)
+    {
+        effect.replayable = false;
+        QStringList cycle = includeGraph->chain.mid (cycleStart);
+        blockParseError (0, "Include cycle: '" + cycle.join ("' includes '") + "' includes '" + absolutePath + "' again.");
+    }
+    
+    if (once)
+    {
+        // Whether anything happens depends on what was included before
+        effect.replayable = false;
+        if (includeGraph->includedFiles.contains (absolutePath))
+            return;
+    }
+    
+    // Nested includes and images are found relative to the includer, so the same file may mean different things elsewhere
+    QString effectKey = searchPath->getDirectories (DATABASE_INCLUDE_DIRECTORIES_CONTEXT).join ("\n") + "\n\n" + absolutePath;
+    auto memoized = includeGraph->effects.constFind (effectKey);
+    if (memoized != includeGraph->effects.constEnd())
+    {
+        replayEffect (memoized.value());
+        return;
+    }
+    
+    shared_ptr <DatabaseParser> subParser (new DatabaseParser);
+    subParser->blockParsers = blockParsers;
+    subParser->includeGraph = includeGraph;
+    subParser->setParsedTags (parsedTags);
+    
+    int messagesBefore = currentDatabase->messages.size();
+    subParser->parseDatabase (contentsNamePair.second, contentsNamePair.first, database, nullptr, searchPath);
+    
+    if (subParser->effect.replayable && currentDatabase->messages.size() == messagesBefore)
+    {
+        includeGraph->effects[effectKey] = subParser->effect;
+        effect.operations += subParser->effect.operations;
+        effect.files += subParser->effect.files;
+    }
+    else
+    {
+        effect.replayable = false;
+    }
+}
+
+void DatabaseParser::recordOperation (IncludeEffect::Kind kind, QString name, QString value)
+{
+    // Values are expanded when they are pushed, so only the ones that expand to themselves can be replayed
+    if (value.contains ('$') || value.contains ('\\'))
+        effect.replayable = false;
+    
+    IncludeEffect::Operation operation = { kind, name, value };
+    effect.operations.push_back (operation);
+}
+
+void DatabaseParser::replayEffect (const IncludeEffect& replayed)
+{
+    for (const IncludeEffect::Operation& operation: replayed.operations)
+        switch (operation.kind)
+        {
+            case IncludeEffect::Kind::IMAGE:
+                currentDatabase->sourceFiles.insert (QFileInfo (operation.value).absoluteFilePath());
+                currentDatabase->variableStack->pushVariable (operation.name, operation.value);
+                break;
+            
+            case IncludeEffect::Kind::VARIABLE:
+                currentDatabase->variableStack->pushVariable (operation.name, operation.value);
+                break;
+            
+            case IncludeEffect::Kind::REPLACEMENT:
+                currentDatabase->replacements.push_back (QPair <QString, QString> (operation.name, operation.value));
+                break;
+            
+            default:
+                failure ("Unknown include effect operation.");
+        }
+    
+    for (QString file: replayed.files)
+    {
+        includeGraph->includedFiles.insert (file);
+        currentDatabase->sourceFiles.insert (file);
+    }
+    
+    effect.operations += replayed.operations;
+    effect.files += replayed.files;
+}
+
+shared_ptr <FlashcardsDatabase> DatabaseParser::parseDatabase (QString fileName, const QString& fileContents, shared_ptr <FlashcardsDatabase> appendTo, shared_ptr <VariableStack> variableStack,
+                                                               FileSearchPathPointer parentSearchPath)
 {
     if (!appendTo)
         appendTo.reset (new FlashcardsDatabase (variableStack));
 
     currentDatabase = appendTo.get();
+    QString absoluteFileName = QFileInfo (fileName).absoluteFilePath();
+    currentDatabase->sourceFiles.insert (absoluteFileName);
+    
+    if (!includeGraph)
+        includeGraph.reset (new IncludeGraph);
+    
+    includeGraph->chain.push_back (absoluteFileName);
+    includeGraph->includedFiles.insert (absoluteFileName);
+    
+    effect.replayable = true;
+    effect.operations.clear();
+    effect.files = QStringList() << absoluteFileName;
 
-    int currentDirectoryPushId = FileReaderSingletone::instance().pushFileSearchPath (QFileInfo (fileName).absolutePath(), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+    searchPath = FileSearchPath::extend (parentSearchPath, QFileInfo (fileName).absolutePath(), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
 
     QStringList lines = fileContents.split ('\n');
+    
+    // Included files are read in the background while the blocks before them are parsed
+    includePrefetcher.reset (new IncludePrefetcher (DATABASE_INCLUDE_DIRECTORIES_CONTEXT, searchPath));
+    includePrefetcher->prefetchIncludes (lines);
 
     currentBlock.clear();
     currentFileName = fileName;
@@ -267,7 +427,9 @@ shared_ptr <FlashcardsDatabase> DatabaseParser::parseDatabase (QString fileName,
         }
     }
 
-    FileReaderSingletone::instance().popFileSearchPath (currentDirectoryPushId);
+    includeGraph->chain.pop_back();
+    searchPath.reset();
+    includePrefetcher.reset();
     currentDatabase = nullptr;
     return appendTo;
 }
@@ -275,7 +437,7 @@ shared_ptr <FlashcardsDatabase> DatabaseParser::parseDatabase (QString fileName,
 QString DatabaseParser::applyReplacements (QString str)
 {
     for (int i = 0; i < currentDatabase->replacements.size(); i++)
-        str = str.replace (QRegExp (currentDatabase->replacements[i].first), currentDatabase->replacements[i].second);
+        str = str.replace (sharedRegExp (currentDatabase->replacements[i].first), currentDatabase->replacements[i].second);
     return str;
 }
 
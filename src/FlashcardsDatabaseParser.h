@@ -3,6 +3,9 @@
 
 #include "FlashcardsDatabase.h"
 #include "FlashcardUtilities.h"
+#include "IncludePrefetcher.h"
+
+#include <QHash>
 
 extern const char* DATABASE_INCLUDE_DIRECTORIES_CONTEXT;
 
@@ -26,6 +29,48 @@ public :
     
     virtual bool acceptsBlock (const QVector <QString>& block) = 0;
     virtual void parseBlock (QVector <QString>& block) = 0;
+    
+    // Called instead of parseBlock for blocks under tags nobody uses; only side effects
+    // that later blocks depend on have to be kept
+    virtual void skipBlock (QVector <QString>&) {}
+};
+
+// What parsing an included file did, if it only consists of directives whose values don't depend on the
+// variables; such a file has the same effect wherever it is included from the same directory
+struct IncludeEffect
+{
+    enum class Kind
+    {
+        VARIABLE,
+        REPLACEMENT,
+        IMAGE
+    };
+    
+    struct Operation
+    {
+        Kind kind;
+        QString name, value;
+    };
+    
+    bool replayable;
+    QVector <Operation> operations;
+    QStringList files;
+};
+
+// Files being included and included so far by a parser and the parsers of its includes
+struct IncludeGraph
+{
+    QStringList chain;
+    QSet <QString> includedFiles;
+    QHash <QString, IncludeEffect> effects;
+};
+
+// Tags whose blocks a parser has to parse: equal to one of the exact tags, or matching one of the wildcard patterns
+struct ParsedTags
+{
+    QStringList exactTags, patterns;
+    
+    bool isEmpty() const { return exactTags.isEmpty() && patterns.isEmpty(); }
 };
 
 class DatabaseParser
@@ -33,7 +78,9 @@ class DatabaseParser
     friend class BlockParser;
     
 public :
-    shared_ptr <FlashcardsDatabase> parseDatabase (QString fileName, const QString& fileContents, shared_ptr <FlashcardsDatabase> appendTo, shared_ptr <VariableStack> variableStack);
+    // Includes are searched for in the directory of the file, then along the search path of the including file
+    shared_ptr <FlashcardsDatabase> parseDatabase (QString fileName, const QString& fileContents, shared_ptr <FlashcardsDatabase> appendTo, shared_ptr <VariableStack> variableStack,
+                                                   FileSearchPathPointer parentSearchPath = FileSearchPathPointer());
     
     template <class T>
     void registerBlockParser (QString name)
@@ -44,23 +91,39 @@ public :
     
     void registerBlockParser (shared_ptr <BlockParser> parser, QString name);
     
+    // Blocks under tags the selection doesn't cover are only segmented, not parsed;
+    // directives and includes still run. An empty selection parses everything.
+    void setParsedTags (ParsedTags tags);
+    
 private :    
     FlashcardsDatabase* currentDatabase;
     QVector <QString> currentBlock;
     int currentBlockFirstLine;
     QString currentFileName;
     QString currentEntryTag;
+    FileSearchPathPointer searchPath;
+    shared_ptr <IncludePrefetcher> includePrefetcher;
+    shared_ptr <IncludeGraph> includeGraph;
+    IncludeEffect effect;
     
     //QMap <int, int> entryIndexToLine;
     
     QMap < QString, shared_ptr <BlockParser> > blockParsers;
     
+    ParsedTags parsedTags;
+    QHash <QString, bool> tagParsed;
+    
+    bool isTagParsed (QString tag);
+    
     void processCurrentBlock();
     
     void blockParseError (int blockLine, QString what);
     void blockParseWarning (int blockLine, QString what);
     
     void processDirective (QString directive, shared_ptr <FlashcardsDatabase> database);
+    void processInclude (QString includePath, bool once, shared_ptr <FlashcardsDatabase> database);
+    void recordOperation (IncludeEffect::Kind kind, QString name, QString value);
+    void replayEffect (const IncludeEffect& replayed);
     
     QString applyReplacements (QString str);
 };
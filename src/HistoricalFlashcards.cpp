@@ -1,8 +1,11 @@
 #include "HistoricalFlashcards.h"
+#include "LineScanner.h"
 
 HistoricalEventFlashcard::HistoricalEventFlashcard (ComplexDate eventDate, QString tag, VariableStackState variableStackState, QString eventName, QString eventDescription) :
     SimpleFlashcard (tag, variableStackState), eventDate (eventDate), eventName (eventName), eventDescription (eventDescription)
-{}
+{
+    eventDate.toKeys (dateBeginKey, dateEndKey);
+}
 
 QString HistoricalEventFlashcard::complexDateToStringLocalized (ComplexDate date)
 {
@@ -85,6 +88,18 @@ QString HistoricalEventFlashcard::getBackSide()
     return getBothSides().second;
 }
 
+QString HistoricalEventFlashcard::getTypeName()
+{
+    return "event";
+}
+
+bool HistoricalEventFlashcard::getDateInterval (quint32& beginKey, quint32& endKey)
+{
+    beginKey = dateBeginKey;
+    endKey = dateEndKey;
+    return true;
+}
+
 HistoricalTermFlashcard::HistoricalTermFlashcard (QString tag, VariableStackState variableStackState, QString termName, QString termDefinition, QString inverseQuestion) :
     SimpleFlashcard (tag, variableStackState), termName (termName), termDefinition (termDefinition), inverseQuestion (inverseQuestion)
 {}
@@ -138,37 +153,47 @@ QString HistoricalTermFlashcard::getBackSide()
     return getBothSides().second;
 }
 
+QString HistoricalTermFlashcard::getTypeName()
+{
+    return "term";
+}
+
 void HistoryBlockParser::updateMonthNames()
 {
+    QStringList allVariants;
     for (unsigned i = 1; i <= 12; i++)
     {
         QString variableName = QString ("month_") + (i < 10 ? "0" : "") + QString::number (i) + "_input_variants";
         QString variants = currentDatabase->variableStack->currentState ().getVariableValue (variableName);
         if (variants.isNull())
             blockParseError (0, "Failed to start parsing block: variants for month " + QString::number (i) + " missing ('" + variableName + "' not defined).");
-        
-        QStringList monthNames = variants.split (' ', QString::SkipEmptyParts);
+        allVariants << variants;
+    }
+    
+    // Called for every date, while the names almost never change
+    if (allVariants == monthVariants)
+        return;
+    monthVariants = allVariants;
+    
+    for (unsigned i = 1; i <= 12; i++)
+    {
+        QStringList monthNames = monthVariants[i - 1].split (' ', QString::SkipEmptyParts);
         assert (!monthNames.empty(), "Every month must have at least one name: missing month " + QString::number(i + 1));
         
         for (QString name: monthNames)
             monthNameToIndex[name.toLower()] = i;
     }
+    
+    monthesMatch = QStringList (monthNameToIndex.keys()).join ("|");
 }
 
 bool HistoryBlockParser::tryExtractSimpleDate (QString& line, SimpleDate& date)
 {    
-    QStringList monthes = monthNameToIndex.keys();
-    QString monthesMatch = "";
-    for (QString monthName: monthes)
-        monthesMatch = (monthesMatch.isEmpty() ? monthName : monthesMatch + "|" + monthName);
-    
     for (int numComponents = 3; numComponents >= 1; numComponents--)
     {
-        QRegExp dateRegExp (numComponents == 3 ? "^(\\d+)\\.(\\d+|" + monthesMatch + ")\\.(\\d+)" :
+        QRegExp dateRegExp = sharedRegExp (numComponents == 3 ? "^(\\d+)\\.(\\d+|" + monthesMatch + ")\\.(\\d+)" :
         numComponents == 2 ? "^(\\d+|" + monthesMatch + ")\\.(\\d+)" :
-        "^(\\d+)");
-        dateRegExp.setCaseSensitivity (Qt::CaseInsensitive);
-        dateRegExp.setPatternSyntax (QRegExp::RegExp2);
+        "^(\\d+)", Qt::CaseInsensitive, QRegExp::RegExp2);
         
         int matchIndex = dateRegExp.indexIn (line);
         
@@ -222,34 +247,6 @@ bool HistoryBlockParser::tryExtractDate (QString& line, ComplexDate& date)
     return true;
 }
 
-void extractDash (QString firstLine, int& dashPosition, QChar& punctuationMet, bool& multipleDashes)
-{
-    int numBracketsOpen = 0;
-    bool escaped = false;
-    
-    for (int i = 0; i < (int)firstLine.size(); i++)
-    {
-        if (firstLine[i] == '(')
-            numBracketsOpen++;
-        else if (firstLine[i] == ')')
-            numBracketsOpen--;
-        else if (firstLine[i] == '-' && !escaped)
-        {
-            if (dashPosition != -1)
-                multipleDashes = true;
-            else
-                dashPosition = i;
-        }
-        else if (dashPosition == -1 && (firstLine[i] == ',' || firstLine[i] == '.' || firstLine[i] == '?'))
-            punctuationMet = firstLine[i];
-        
-        if (firstLine[i] == '\\')
-            escaped = true;
-        else
-            escaped = false;
-    }
-}
-
 bool HistoryBlockParser::acceptsBlock (const QVector <QString>& block)
 {
     ComplexDate date;
@@ -257,12 +254,7 @@ bool HistoryBlockParser::acceptsBlock (const QVector <QString>& block)
     if (tryExtractDate (firstLine, date))
         return true;
     
-    int dashPosition = -1;
-    QChar punctuationMet = 0;
-    bool multipleDashes = false;
-    extractDash (firstLine, dashPosition, punctuationMet, multipleDashes);
-    
-    return dashPosition != -1;
+    return scanLine (firstLine).hasUnescapedDash();
 }
 
 void HistoryBlockParser::parseBlock (QVector <QString>& block)
@@ -277,6 +269,10 @@ void HistoryBlockParser::parseBlock (QVector <QString>& block)
     {
         //qstdout << "Got " << date << " and string '" << firstLine << "'" << endl;
         
+        if (!date.begin.isInRange() || !date.end.isInRange())
+            blockParseWarning (0, "Day or month out of range in date " + date.toString() + "; the event is dated by its whole month or year.");
+        
+        LineScan scan = scanLine (firstLine);
         firstLine = firstLine.trimmed();
         if (firstLine.isEmpty() || firstLine[0] != '-')
             blockParseError (0, "Expected a dash followed by an event name after a date interval, " +
@@ -289,15 +285,14 @@ void HistoryBlockParser::parseBlock (QVector <QString>& block)
         
         firstLine[0] = firstLine[0].toUpper();
         
-        if (isEndingSymbol (firstLine[firstLine.length() - 1]) && (firstLine.length() <= 1 || firstLine[firstLine.length() - 2] != '\\'))
+        // The name keeps the last symbol of the line and whatever precedes it
+        if (isEndingSymbol (scan.lastSymbol) && !scan.lastSymbolEscaped)
             blockParseWarning (0, QString ("An event name ends in unescaped '") + firstLine[firstLine.length() - 1] + "'");
         
-        QRegExp unescapedDash ("^-|[^\\\\]-");
-        
         QString eventDescription = "";
         for (unsigned i = 0; i < block.size(); i++)
         {
-            //if (unescapedDash.indexIn (i == 0 ? firstLine : currentBlock[i]) != -1)
+            //if (scanLine (i == 0 ? firstLine : currentBlock[i]).hasUnescapedDash())
             //  blockParseWarning (i, "Unescaped dash met outside of a date interval/definition construction.");
             
             if (i == 0) continue;
@@ -306,17 +301,15 @@ void HistoryBlockParser::parseBlock (QVector <QString>& block)
         
         currentDatabase->entries.push_back (
             shared_ptr <SimpleFlashcard> (new HistoricalEventFlashcard (date, currentEntryTag, currentDatabase->variableStack->currentState(),
-                                                                        applyReplacements (replaceEscapes (firstLine)), applyReplacements (replaceEscapes (eventDescription.trimmed())))));
+                                                                        applyReplacements (scan.hasBackslashes ? replaceEscapes (firstLine) : firstLine),
+                                                                        applyReplacements (replaceEscapes (eventDescription.trimmed())))));
     }
     else
     {
         // Try to treat as a term definition
         
-        int dashPosition = -1;
-        QChar punctuationMet = 0;
-        bool multipleDashes = false;
-        
-        extractDash (firstLine, dashPosition, punctuationMet, multipleDashes);
+        LineScan scan = scanLine (firstLine);
+        int dashPosition = scan.firstDash;
         
         verify (dashPosition != -1, "parseBlock method assumes the block is accepted.");
         QString beforeDash = firstLine.left (dashPosition).trimmed();
@@ -329,23 +322,21 @@ void HistoryBlockParser::parseBlock (QVector <QString>& block)
         
         afterDash[0] = afterDash[0].toUpper();
         
-        if (multipleDashes)
+        if (scan.multipleDashes)
             blockParseWarning (0, "Unescaped dash in a term definition.");
         
-        if (!punctuationMet.isNull())
-            blockParseWarning (0, QString ("Unescaped punctuation symbol '") + punctuationMet + "' met outside of parentheses.");
+        if (!scan.punctuationBeforeDash.isNull())
+            blockParseWarning (0, QString ("Unescaped punctuation symbol '") + scan.punctuationBeforeDash + "' met outside of parentheses.");
         
+        // Capitalization may have changed a one-letter definition, so the symbol itself is taken from it
         QChar definitionEnd = afterDash[afterDash.length() - 1];
-        if ((afterDash.length() == 1 || afterDash[afterDash.length() - 2] != '\\') &&
-            (!isEndingSymbol (definitionEnd) || definitionEnd == '?'))
+        if (!scan.lastSymbolEscaped && (!isEndingSymbol (definitionEnd) || definitionEnd == '?'))
             blockParseWarning (0, QString ("Term definition ends in unescaped '") + definitionEnd + "'.");
         
-        QRegExp unescapedDash ("^-|[^\\\\]-");
-        
         QString inverseQuestion = "";
         for (unsigned i = 1; i < block.size(); i++)
         {
-            if (unescapedDash.indexIn (block[i]) != -1)
+            if (scanLine (block[i]).hasUnescapedDash())
                 blockParseWarning (i, "Unescaped dash met in a term inverse question.");
             
             inverseQuestion += (i > 1 ? "\n" : "") + block[i];
@@ -353,7 +344,8 @@ void HistoryBlockParser::parseBlock (QVector <QString>& block)
         
         currentDatabase->entries.push_back
         (shared_ptr <SimpleFlashcard> (new HistoricalTermFlashcard (currentEntryTag, currentDatabase->variableStack->currentState(),
-                                                                    applyReplacements (replaceEscapes (beforeDash)), applyReplacements (replaceEscapes (afterDash)),
+                                                                    applyReplacements (scan.hasBackslashes ? replaceEscapes (beforeDash) : beforeDash),
+                                                                    applyReplacements (scan.hasBackslashes ? replaceEscapes (afterDash) : afterDash),
                                                                     applyReplacements (replaceEscapes (inverseQuestion.trimmed())))));
     }
 }
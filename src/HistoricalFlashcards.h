@@ -10,6 +10,7 @@
 class HistoricalEventFlashcard : public SimpleFlashcard
 {
     ComplexDate eventDate;
+    quint32 dateBeginKey, dateEndKey;
     QString eventName, eventDescription;
     
     QPair <QString, QString> getBothSides();
@@ -22,6 +23,8 @@ public :
     
     QString getBackSide();
     QString getFrontSide();
+    QString getTypeName();
+    bool getDateInterval (quint32& beginKey, quint32& endKey);
 };
 
 class HistoricalTermFlashcard : public SimpleFlashcard
@@ -35,6 +38,7 @@ public :
 
     QString getBackSide();
     QString getFrontSide();
+    QString getTypeName();
 };
 
 class HistoryBlockParser : public BlockParser
@@ -50,6 +54,10 @@ public :
 private :
     QMap <QString, int> monthNameToIndex;
     
+    // Month variables the names were taken from, and the names joined for a regular expression
+    QStringList monthVariants;
+    QString monthesMatch;
+    
     bool tryExtractDate (QString& line, ComplexDate& date);
     bool tryExtractSimpleDate (QString& line, SimpleDate& date);
     void updateMonthNames();
@@ -0,0 +1,167 @@
+#include "IncludePrefetcher.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QRunnable>
+
+struct IncludePrefetcher::PendingRead
+{
+	QMutex mutex;
+	QWaitCondition finished;
+	bool done, succeeded;
+	QPair <QString, QString> result;
+
+	// Printed by the parser once it takes the file, so that it goes to the output of its command
+	QString output, errors, warnings;
+
+	PendingRead() :
+		done (false), succeeded (false)
+	{}
+};
+
+namespace
+{
+	// Reads wait on the disk (or the network) rather than on the processor, so there are more of them than cores
+	const int PREFETCH_THREADS = 8;
+
+	QThreadPool& prefetchPool()
+	{
+		static QThreadPool* pool = [] ()
+		{
+			QThreadPool* pool = new QThreadPool;
+			pool->setMaxThreadCount (PREFETCH_THREADS);
+			return pool;
+		} ();
+
+		return *pool;
+	}
+
+	class PrefetchTask : public QRunnable
+	{
+	public :
+		PrefetchTask (shared_ptr <IncludePrefetcher::PendingRead> read, QString fileName, QString context, FileSearchPathPointer searchPath) :
+			read (read), fileName (fileName), context (context), searchPath (searchPath)
+		{}
+
+		void run()
+		{
+			QPair <QString, QString> result;
+			QString output, errors, warnings;
+			bool succeeded = true;
+
+			// Errors are the parser's to report, once it really needs the file, so a failure leaves nothing behind
+			bool previousRecoverable = setRecoverableFailures (true);
+			{
+				StandardStreamsCapture capture;
+				try
+				{
+					result = FileReaderSingletone::instance().readContents (fileName, context, searchPath, warnings);
+				}
+				catch (HaltException&)
+				{
+					succeeded = false;
+				}
+
+				output = capture.takeOutput();
+				errors = capture.takeErrors();
+			}
+			setRecoverableFailures (previousRecoverable);
+
+			QMutexLocker locker (&read->mutex);
+			read->result = result;
+			read->succeeded = succeeded;
+
+			if (succeeded)
+			{
+				read->output = output;
+				read->errors = errors;
+				read->warnings = warnings;
+			}
+
+			read->done = true;
+			read->finished.wakeAll();
+		}
+
+	private :
+		shared_ptr <IncludePrefetcher::PendingRead> read;
+		QString fileName, context;
+		FileSearchPathPointer searchPath;
+	};
+}
+
+IncludePrefetcher::IncludePrefetcher (QString context, FileSearchPathPointer searchPath) :
+	context (context), searchPath (searchPath),
+	// Files supplied by a resolver belong to the calling thread and are at hand anyway
+	enabled (FileReaderSingletone::instance().getThreadFileResolver() == nullptr)
+{}
+
+IncludePrefetcher::~IncludePrefetcher()
+{
+	for (shared_ptr <PendingRead>& read: pendingReads)
+	{
+		QMutexLocker locker (&read->mutex);
+		while (!read->done)
+			read->finished.wait (&read->mutex);
+	}
+}
+
+void IncludePrefetcher::prefetchIncludes (const QStringList& lines)
+{
+	const QString includeDirectivePrefix = "#include ", includeOnceDirectivePrefix = "#include_once ";
+
+	// Comments are skipped the way DatabaseParser::parseDatabase does it: directive lines never open one
+	bool commentOpen = false;
+
+	for (QString line: lines)
+	{
+		if (commentOpen)
+		{
+			int commentClosing = line.indexOf ("*/");
+			if (commentClosing == -1)
+				continue;
+
+			line = line.mid (commentClosing + 2);
+			commentOpen = false;
+		}
+
+		if (line.startsWith (includeDirectivePrefix))
+			prefetch (line.mid (includeDirectivePrefix.length()));
+		else if (line.startsWith (includeOnceDirectivePrefix))
+			prefetch (line.mid (includeOnceDirectivePrefix.length()));
+		else if (!line.startsWith ('#'))
+			commentOpen = line.left (line.indexOf ("//")).contains ("/*");
+	}
+}
+
+void IncludePrefetcher::prefetch (QString fileName)
+{
+	if (!enabled || pendingReads.contains (fileName))
+		return;
+
+	shared_ptr <PendingRead> read (new PendingRead);
+	pendingReads[fileName] = read;
+	prefetchPool().start (new PrefetchTask (read, fileName, context, searchPath));
+}
+
+QPair <QString, QString> IncludePrefetcher::readContents (QString fileName)
+{
+	shared_ptr <PendingRead> read = pendingReads.take (fileName);
+
+	if (read)
+	{
+		QMutexLocker locker (&read->mutex);
+		while (!read->done)
+			read->finished.wait (&read->mutex);
+
+		if (read->succeeded)
+		{
+			qstdout << read->output << flush;
+			qstderr << read->errors << read->warnings << flush;
+			return read->result;
+		}
+	}
+
+	return FileReaderSingletone::instance().readContents (fileName, context, searchPath);
+}
@@ -0,0 +1,44 @@
+#ifndef INCLUDE_PREFETCHER_H
+#define INCLUDE_PREFETCHER_H
+
+#include <memory>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QPair>
+
+#include "Util.h"
+
+using std::shared_ptr;
+
+// Reads files a parse is going to include on background I/O threads, so that the parser finds them ready
+// when it gets to the directives. Files are resolved and read exactly as FileReaderSingletone::readContents
+// would do it for the parse; a prefetch that fails is forgotten and the parser reads the file itself,
+// getting the usual error. Messages of a prefetch are printed by the parser when it takes the file.
+class IncludePrefetcher
+{
+public :
+	IncludePrefetcher (QString context, FileSearchPathPointer searchPath);
+
+	// Waits for the reads still running, so that none outlives the parse (e.g. one halted by a failure)
+	~IncludePrefetcher();
+
+	// Starts reading every file the "#include " and "#include_once " lines outside of comments name
+	void prefetchIncludes (const QStringList& lines);
+	void prefetch (QString fileName);
+
+	// Contents & absolute file path, waiting for the prefetch of the file if it is still running
+	QPair <QString, QString> readContents (QString fileName);
+
+	// Filled in by a background thread
+	struct PendingRead;
+
+private :
+	QString context;
+	FileSearchPathPointer searchPath;
+	bool enabled;
+
+	QHash < QString, shared_ptr <PendingRead> > pendingReads;
+};
+
+#endif // INCLUDE_PREFETCHER_H
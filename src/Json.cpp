@@ -0,0 +1,294 @@
+#include "Json.h"
+
+#include <QStringList>
+
+namespace
+{
+	class JsonParser
+	{
+	public :
+		JsonParser (const QString& text) :
+			text (text), position (0)
+		{}
+
+		bool parseDocument (QVariant& value, QString& error)
+		{
+			if (!parseValue (value) || (skipSpaces(), position != text.size()))
+			{
+				if (errorMessage.isEmpty())
+					errorMessage = "unexpected trailing characters";
+
+				error = errorMessage + " at offset " + QString::number (position);
+				return false;
+			}
+
+			return true;
+		}
+
+	private :
+		const QString& text;
+		int position;
+		QString errorMessage;
+
+		bool fail (QString message)
+		{
+			errorMessage = message;
+			return false;
+		}
+
+		void skipSpaces()
+		{
+			while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\r' || text[position] == '\n'))
+				position++;
+		}
+
+		bool consume (QString literal)
+		{
+			if (text.midRef (position, literal.size()) != literal)
+				return false;
+
+			position += literal.size();
+			return true;
+		}
+
+		bool parseValue (QVariant& value)
+		{
+			skipSpaces();
+			if (position >= text.size())
+				return fail ("unexpected end of input");
+
+			QChar c = text[position];
+			if (c == '{') return parseObject (value);
+			if (c == '[') return parseArray (value);
+
+			if (c == '"')
+			{
+				QString string;
+				if (!parseString (string))
+					return false;
+
+				value = string;
+				return true;
+			}
+
+			if (consume ("true")) { value = true; return true; }
+			if (consume ("false")) { value = false; return true; }
+			if (consume ("null")) { value = QVariant(); return true; }
+
+			return parseNumber (value);
+		}
+
+		bool parseObject (QVariant& value)
+		{
+			QVariantMap object;
+			position++;
+
+			skipSpaces();
+			if (consume ("}"))
+			{
+				value = object;
+				return true;
+			}
+
+			for (;;)
+			{
+				skipSpaces();
+				QString key;
+				if (position >= text.size() || text[position] != '"')
+					return fail ("object key expected");
+				if (!parseString (key))
+					return false;
+
+				skipSpaces();
+				if (!consume (":"))
+					return fail ("':' expected");
+
+				QVariant member;
+				if (!parseValue (member))
+					return false;
+				object[key] = member;
+
+				skipSpaces();
+				if (consume ("}"))
+					break;
+				if (!consume (","))
+					return fail ("',' or '}' expected");
+			}
+
+			value = object;
+			return true;
+		}
+
+		bool parseArray (QVariant& value)
+		{
+			QVariantList array;
+			position++;
+
+			skipSpaces();
+			if (consume ("]"))
+			{
+				value = array;
+				return true;
+			}
+
+			for (;;)
+			{
+				QVariant element;
+				if (!parseValue (element))
+					return false;
+				array.push_back (element);
+
+				skipSpaces();
+				if (consume ("]"))
+					break;
+				if (!consume (","))
+					return fail ("',' or ']' expected");
+			}
+
+			value = array;
+			return true;
+		}
+
+		bool parseString (QString& string)
+		{
+			position++;
+
+			for (;;)
+			{
+				if (position >= text.size())
+					return fail ("unterminated string");
+
+				QChar c = text[position++];
+				if (c == '"')
+					return true;
+
+				if (c != '\\')
+				{
+					string += c;
+					continue;
+				}
+
+				if (position >= text.size())
+					return fail ("unterminated string");
+
+				QChar escaped = text[position++];
+				switch (escaped.unicode())
+				{
+					case '"': string += '"'; break;
+					case '\\': string += '\\'; break;
+					case '/': string += '/'; break;
+					case 'b': string += '\b'; break;
+					case 'f': string += '\f'; break;
+					case 'n': string += '\n'; break;
+					case 'r': string += '\r'; break;
+					case 't': string += '\t'; break;
+
+					case 'u':
+					{
+						// Surrogate pairs come as two escapes, which are exactly the two UTF-16 units
+						bool parsed = false;
+						ushort unit = text.mid (position, 4).toUShort (&parsed, 16);
+						if (!parsed || position + 4 > text.size())
+							return fail ("invalid unicode escape");
+
+						string += QChar (unit);
+						position += 4;
+						break;
+					}
+
+					default:
+						return fail (QString ("invalid escape '\\") + escaped + "'");
+				}
+			}
+		}
+
+		bool parseNumber (QVariant& value)
+		{
+			int begin = position;
+			while (position < text.size() && (text[position].isDigit() || QString ("+-.eE").contains (text[position])))
+				position++;
+
+			bool parsed = false;
+			double number = text.mid (begin, position - begin).toDouble (&parsed);
+			if (begin == position || !parsed)
+			{
+				position = begin;
+				return fail ("value expected");
+			}
+
+			value = number;
+			return true;
+		}
+	};
+
+	QString quoteString (const QString& string)
+	{
+		QString quoted = "\"";
+
+		for (QChar c: string)
+		{
+			switch (c.unicode())
+			{
+				case '"': quoted += "\\\""; break;
+				case '\\': quoted += "\\\\"; break;
+				case '\n': quoted += "\\n"; break;
+				case '\r': quoted += "\\r"; break;
+				case '\t': quoted += "\\t"; break;
+
+				default:
+					if (c.unicode() < 0x20)
+						quoted += QString ("\\u%1").arg (c.unicode(), 4, 16, QChar ('0'));
+					else
+						quoted += c;
+			}
+		}
+
+		return quoted + "\"";
+	}
+}
+
+bool parseJson (const QString& text, QVariant& value, QString& error)
+{
+	JsonParser parser (text);
+	return parser.parseDocument (value, error);
+}
+
+QString toJson (const QVariant& value)
+{
+	// Most of the types are written as strings, so they aren't listed one by one
+	switch (static_cast <int> (value.type()))
+	{
+		case QVariant::Invalid:
+			return "null";
+
+		case QVariant::Bool:
+			return value.toBool() ? "true" : "false";
+
+		case QVariant::Int:
+		case QVariant::UInt:
+		case QVariant::LongLong:
+		case QVariant::ULongLong:
+		case QVariant::Double:
+			return QString::number (value.toDouble(), 'g', 15);
+
+		case QVariant::List:
+		{
+			QStringList elements;
+			for (const QVariant& element: value.toList())
+				elements << toJson (element);
+			return "[" + elements.join (",") + "]";
+		}
+
+		case QVariant::Map:
+		{
+			QVariantMap object = value.toMap();
+			QStringList members;
+			for (auto it = object.begin(); it != object.end(); it++)
+				members << quoteString (it.key()) + ":" + toJson (it.value());
+			return "{" + members.join (",") + "}";
+		}
+
+		default:
+			return quoteString (value.toString());
+	}
+}
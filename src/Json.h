@@ -0,0 +1,14 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <QString>
+#include <QVariant>
+
+// Just enough JSON for line-based protocols: objects become QVariantMap, arrays QVariantList,
+// numbers double, and strings, booleans and null the matching QVariant values.
+bool parseJson (const QString& text, QVariant& value, QString& error);
+
+// Serializes on a single line, so that the result can be sent as one protocol message
+QString toJson (const QVariant& value);
+
+#endif // JSON_H
@@ -0,0 +1,89 @@
+#include "LineScanner.h"
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+namespace
+{
+    inline bool isScannedSymbol (ushort c)
+    {
+        return c == '-' || c == '\\' || c == ',' || c == '.' || c == '?';
+    }
+    
+    inline void scanSymbol (const ushort* data, int i, LineScan& scan)
+    {
+        ushort c = data[i];
+        
+        switch (c)
+        {
+            case '\\':
+                scan.hasBackslashes = true;
+                break;
+            
+            case '-':
+                if (i > 0 && data[i - 1] == '\\')
+                    break;
+                
+                if (scan.firstDash != -1)
+                    scan.multipleDashes = true;
+                else
+                    scan.firstDash = i;
+                break;
+            
+            default:
+                if (scan.firstDash == -1)
+                    scan.punctuationBeforeDash = QChar (c);
+                break;
+        }
+    }
+    
+#ifdef __SSE2__
+    // Two bits per character that is one of the scanned symbols
+    inline int scannedSymbolsMask (const ushort* data)
+    {
+        __m128i chunk = _mm_loadu_si128 (reinterpret_cast <const __m128i*> (data));
+        
+        __m128i matches = _mm_or_si128 (_mm_cmpeq_epi16 (chunk, _mm_set1_epi16 ('-')), _mm_cmpeq_epi16 (chunk, _mm_set1_epi16 ('\\')));
+        matches = _mm_or_si128 (matches, _mm_cmpeq_epi16 (chunk, _mm_set1_epi16 (',')));
+        matches = _mm_or_si128 (matches, _mm_cmpeq_epi16 (chunk, _mm_set1_epi16 ('.')));
+        matches = _mm_or_si128 (matches, _mm_cmpeq_epi16 (chunk, _mm_set1_epi16 ('?')));
+        
+        return _mm_movemask_epi8 (matches);
+    }
+#endif
+}
+
+LineScan scanLine (const QString& line)
+{
+    LineScan scan;
+    scan.firstDash = -1;
+    scan.multipleDashes = false;
+    scan.hasBackslashes = false;
+    scan.lastSymbolEscaped = false;
+    
+    const ushort* data = line.utf16();
+    int length = line.size(), i = 0;
+    
+#ifdef __SSE2__
+    for (; i + 8 <= length; i += 8)
+        for (int mask = scannedSymbolsMask (data + i); mask != 0; mask &= mask - 1, mask &= mask - 1)
+            scanSymbol (data, i + __builtin_ctz (mask) / 2, scan);
+#endif
+    
+    for (; i < length; i++)
+        if (isScannedSymbol (data[i]))
+            scanSymbol (data, i, scan);
+    
+    int last = length - 1;
+    while (last >= 0 && line[last].isSpace())
+        last--;
+    
+    if (last >= 0)
+    {
+        scan.lastSymbol = line[last];
+        scan.lastSymbolEscaped = last > 0 && line[last - 1] == '\\';
+    }
+    
+    return scan;
+}
@@ -0,0 +1,33 @@
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#include <QString>
+
+// What block parsers need to know about a line, found in one pass over it. A character is escaped if the
+// previous one is a backslash, whether or not that backslash is escaped itself.
+struct LineScan
+{
+    // First unescaped dash and whether there are more of them
+    int firstDash;
+    bool multipleDashes;
+    
+    // The last of ',', '.' and '?' (escaped or not) before the first unescaped dash, null if none
+    QChar punctuationBeforeDash;
+    
+    // Parts of a line without backslashes have no escapes to replace
+    bool hasBackslashes;
+    
+    // Last character other than whitespace (null for a blank line) and whether it is escaped
+    QChar lastSymbol;
+    bool lastSymbolEscaped;
+    
+    bool hasUnescapedDash() const
+    {
+        return firstDash != -1;
+    }
+};
+
+// Looks at eight characters at a time where SSE2 is available; only the characters above are examined one by one
+LineScan scanLine (const QString& line);
+
+#endif // LINE_SCANNER_H
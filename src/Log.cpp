@@ -0,0 +1,87 @@
+#include "Log.h"
+#include "Util.h"
+
+#include <QMap>
+#include <QStringList>
+#include <cstdlib>
+
+namespace
+{
+	struct LogSettings
+	{
+		LogLevel defaultLevel;
+		QMap <QString, LogLevel> categoryLevels;
+	};
+
+	bool parseLevel (QString name, LogLevel& level)
+	{
+		name = name.trimmed().toLower();
+
+		if (name == "trace")
+			level = LogLevel::TRACE;
+		else if (name == "debug")
+			level = LogLevel::DEBUG;
+		else if (name == "info")
+			level = LogLevel::INFO;
+		else if (name == "warning")
+			level = LogLevel::WARNING;
+		else
+			return false;
+
+		return true;
+	}
+
+	const LogSettings& logSettings()
+	{
+		static LogSettings settings = [] ()
+		{
+			LogSettings parsed;
+			parsed.defaultLevel = LogLevel::WARNING;
+
+			// Unknown levels are ignored rather than reported: there's no log to report them to yet
+			for (QString item: QString::fromLocal8Bit (getenv ("TE_EXPORTER_LOG")).split (',', QString::SkipEmptyParts))
+			{
+				int colon = item.indexOf (':');
+				LogLevel level;
+
+				if (colon == -1)
+				{
+					if (parseLevel (item, level))
+						parsed.defaultLevel = level;
+				}
+				else if (parseLevel (item.mid (colon + 1), level))
+				{
+					parsed.categoryLevels[item.left (colon).trimmed()] = level;
+				}
+			}
+
+			return parsed;
+		} ();
+
+		return settings;
+	}
+
+	const char* levelName (LogLevel level)
+	{
+		switch (level)
+		{
+			case LogLevel::TRACE:   return "trace";
+			case LogLevel::DEBUG:   return "debug";
+			case LogLevel::INFO:    return "info";
+			case LogLevel::WARNING: return "warning";
+			default:                return "";
+		}
+	}
+}
+
+bool logEnabled (LogLevel level, const char* category)
+{
+	const LogSettings& settings = logSettings();
+	return level >= settings.categoryLevels.value (QString::fromLatin1 (category), settings.defaultLevel);
+}
+
+void logMessage (LogLevel level, const char* category, const QString& message)
+{
+	// No flush: the streams are flushed when the run ends or halts
+	qstderr << "[" << levelName (level) << "] " << category << ": " << message << "\n";
+}
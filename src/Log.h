@@ -0,0 +1,37 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <QString>
+
+// Diagnostic messages by level and category, written to qstderr without flushing it. Levels and categories
+// are picked at run time with TE_EXPORTER_LOG, e.g. "debug" or "rules:trace,parser:debug"; by default
+// only warnings are shown. Messages are only formatted if they are going to be written.
+//
+// Trace and debug messages are compiled in only if TE_EXPORTER_DEBUG_LOGGING is defined (debug builds);
+// otherwise their arguments aren't even evaluated.
+
+enum class LogLevel
+{
+	TRACE,
+	DEBUG,
+	INFO,
+	WARNING
+};
+
+bool logEnabled (LogLevel level, const char* category);
+void logMessage (LogLevel level, const char* category, const QString& message);
+
+#define _log(level, category, message) ((void)(logEnabled (level, category) && (logMessage (level, category, QString (message)), 1)))
+
+#ifdef TE_EXPORTER_DEBUG_LOGGING
+#	define logTrace(category, message) _log (LogLevel::TRACE, category, message)
+#	define logDebug(category, message) _log (LogLevel::DEBUG, category, message)
+#else
+#	define logTrace(category, message) ((void)0)
+#	define logDebug(category, message) ((void)0)
+#endif // TE_EXPORTER_DEBUG_LOGGING
+
+#define logInfo(category, message)    _log (LogLevel::INFO, category, message)
+#define logWarning(category, message) _log (LogLevel::WARNING, category, message)
+
+#endif // LOG_H
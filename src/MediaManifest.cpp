@@ -0,0 +1,240 @@
+#include "MediaManifest.h"
+#include "Util.h"
+
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QTextStream>
+#include <QCryptographicHash>
+#include <QMutexLocker>
+#include <memory>
+
+using std::shared_ptr;
+
+const char* MediaManifest::FILE_NAME = "media-manifest.txt";
+const char* MediaManifest::SOURCES_FILE_NAME = "media-sources.txt";
+
+namespace
+{
+	struct KnownHash
+	{
+		qint64 size, modified;
+		QString hash;
+	};
+
+	QMutex knownHashesMutex;
+	QMap <QString, KnownHash> knownHashes;
+
+	// Line format: source path, hash, size, modification time in msecs
+	QMap <QString, KnownHash> readKnownHashes (QString mediaDirectory)
+	{
+		QMap <QString, KnownHash> result;
+
+		QFile file (QDir (mediaDirectory).filePath (MediaManifest::SOURCES_FILE_NAME));
+		if (!file.open (QIODevice::ReadOnly | QIODevice::Text))
+			return result;
+
+		QTextStream stream (&file);
+		stream.setCodec ("UTF-8");
+
+		while (!stream.atEnd())
+		{
+			QStringList fields = stream.readLine().split ('\t');
+			if (fields.size() != 4)
+				continue;
+
+			KnownHash knownHash;
+			bool sizeParsed = false, modifiedParsed = false;
+			knownHash.hash = fields[1];
+			knownHash.size = fields[2].toLongLong (&sizeParsed);
+			knownHash.modified = fields[3].toLongLong (&modifiedParsed);
+
+			// A damaged line only makes the source hashed again
+			if (sizeParsed && modifiedParsed)
+				result[fields[0]] = knownHash;
+		}
+
+		return result;
+	}
+}
+
+QString fileContentHash (QString absolutePath)
+{
+	QFileInfo fileInfo (absolutePath);
+	qint64 size = fileInfo.size(), modified = fileInfo.lastModified().toMSecsSinceEpoch();
+
+	{
+		QMutexLocker locker (&knownHashesMutex);
+		auto it = knownHashes.find (absolutePath);
+		if (it != knownHashes.end() && it.value().size == size && it.value().modified == modified)
+			return it.value().hash;
+	}
+
+	QFile file (absolutePath);
+	verify (file.open (QIODevice::ReadOnly), "Failed to open resource '" + absolutePath + "' for hashing.");
+
+	QCryptographicHash hash (QCryptographicHash::Sha1);
+	while (!file.atEnd())
+	{
+		QByteArray chunk = file.read (1 << 16);
+		verify (!chunk.isEmpty(), "Failed to read resource '" + absolutePath + "'.");
+		hash.addData (chunk);
+	}
+
+	QString result = QString::fromLatin1 (hash.result().toHex());
+
+	KnownHash knownHash = { size, modified, result };
+	QMutexLocker locker (&knownHashesMutex);
+	knownHashes[absolutePath] = knownHash;
+
+	return result;
+}
+
+void loadKnownHashes (QString mediaDirectory)
+{
+	QMap <QString, KnownHash> recorded = readKnownHashes (mediaDirectory);
+
+	// Digests computed by this process are never older than recorded ones
+	QMutexLocker locker (&knownHashesMutex);
+	for (auto it = recorded.begin(); it != recorded.end(); it++)
+		if (!knownHashes.contains (it.key()))
+			knownHashes[it.key()] = it.value();
+}
+
+void saveKnownHashes (QString mediaDirectory, const QStringList& sourcePaths)
+{
+	// Other decks sharing the directory recorded their sources too; keep those that still exist
+	QMap <QString, KnownHash> recorded = readKnownHashes (mediaDirectory);
+	for (auto it = recorded.begin(); it != recorded.end(); )
+		it = QFileInfo (it.key()).exists() ? it + 1 : recorded.erase (it);
+
+	{
+		QMutexLocker locker (&knownHashesMutex);
+		for (QString sourcePath: sourcePaths)
+			if (knownHashes.contains (sourcePath))
+				recorded[sourcePath] = knownHashes[sourcePath];
+	}
+
+	QDir directory (mediaDirectory);
+	QString sourcesPath = directory.filePath (MediaManifest::SOURCES_FILE_NAME), temporaryPath = sourcesPath + ".new";
+
+	QFile file (temporaryPath);
+	verify (file.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to write media sources '" + temporaryPath + "'.");
+
+	{
+		QTextStream stream (&file);
+		stream.setCodec ("UTF-8");
+
+		for (auto it = recorded.begin(); it != recorded.end(); it++)
+			stream << it.key() << "\t" << it.value().hash << "\t" << it.value().size << "\t" << it.value().modified << "\n";
+	}
+	file.close();
+
+	QFile::remove (sourcesPath);
+	verify (QFile::rename (temporaryPath, sourcesPath), "Failed to replace media sources '" + sourcesPath + "'.");
+}
+
+QMutex& MediaManifest::lockDirectory (QString mediaDirectory)
+{
+	static QMutex registryMutex;
+	static QMap < QString, shared_ptr <QMutex> > directoryMutexes;
+
+	QMutexLocker locker (&registryMutex);
+	QString key = QDir (mediaDirectory).absolutePath();
+	if (directoryMutexes.count (key) == 0)
+		directoryMutexes[key] = shared_ptr <QMutex> (new QMutex);
+
+	return *directoryMutexes[key];
+}
+
+void MediaManifest::load (QString mediaDirectory)
+{
+	entries.clear();
+
+	QFile file (QDir (mediaDirectory).filePath (FILE_NAME));
+	if (!file.open (QIODevice::ReadOnly | QIODevice::Text))
+		return;
+
+	QTextStream stream (&file);
+	stream.setCodec ("UTF-8");
+
+	// Line format: name, hash, size, modification time in msecs, deck files separated by '|' (optional)
+	while (!stream.atEnd())
+	{
+		QStringList fields = stream.readLine().split ('\t');
+		if (fields.size() != 4 && fields.size() != 5)
+			continue;
+
+		Entry entry;
+		bool sizeParsed = false, modifiedParsed = false;
+		entry.hash = fields[1];
+		entry.size = fields[2].toLongLong (&sizeParsed);
+		entry.modified = fields[3].toLongLong (&modifiedParsed);
+		if (fields.size() == 5)
+			entry.decks = fields[4].split ('|', QString::SkipEmptyParts).toSet();
+
+		// A damaged line only makes the file look changed and copied again
+		if (sizeParsed && modifiedParsed)
+			entries[fields[0]] = entry;
+	}
+}
+
+void MediaManifest::save (QString mediaDirectory)
+{
+	QDir directory (mediaDirectory);
+	QString manifestPath = directory.filePath (FILE_NAME), temporaryPath = manifestPath + ".new";
+
+	QFile file (temporaryPath);
+	verify (file.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to write media manifest '" + temporaryPath + "'.");
+
+	{
+		QTextStream stream (&file);
+		stream.setCodec ("UTF-8");
+
+		for (auto it = entries.begin(); it != entries.end(); it++)
+			stream << it.key() << "\t" << it.value().hash << "\t" << it.value().size << "\t" << it.value().modified << "\t" << QStringList (it.value().decks.toList()).join ("|") << "\n";
+	}
+	file.close();
+
+	QFile::remove (manifestPath);
+	verify (QFile::rename (temporaryPath, manifestPath), "Failed to replace media manifest '" + manifestPath + "'.");
+}
+
+bool MediaManifest::isUpToDate (QString name, const QFileInfo& file) const
+{
+	auto it = entries.find (name);
+	return it != entries.end() && file.exists() && file.size() == it.value().size && file.lastModified().toMSecsSinceEpoch() == it.value().modified;
+}
+
+void MediaManifest::update (QString name, QString hash, const QFileInfo& file)
+{
+	Entry& entry = entries[name];
+	entry.hash = hash;
+	entry.size = file.size();
+	entry.modified = file.lastModified().toMSecsSinceEpoch();
+}
+
+void MediaManifest::remove (QString name)
+{
+	entries.remove (name);
+}
+
+void MediaManifest::setDeckResources (QString deckFileName, const QSet <QString>& usedNames)
+{
+	for (auto it = entries.begin(); it != entries.end(); it++)
+	{
+		if (usedNames.contains (it.key()))
+			it.value().decks.insert (deckFileName);
+		else
+			it.value().decks.remove (deckFileName);
+	}
+}
+
+QStringList MediaManifest::orphans() const
+{
+	QStringList result;
+	for (auto it = entries.begin(); it != entries.end(); it++)
+		if (it.value().decks.isEmpty())
+			result.push_back (it.key());
+	return result;
+}
@@ -0,0 +1,59 @@
+#ifndef MEDIA_MANIFEST_H
+#define MEDIA_MANIFEST_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QSet>
+#include <QFileInfo>
+#include <QMutex>
+
+// Hex digest of the file contents; deck resources are named after it.
+// Digests are remembered for the whole process while the file size and modification time stay the same.
+QString fileContentHash (QString absolutePath);
+
+// Digests of source files are also kept next to the manifest (in MediaManifest::SOURCES_FILE_NAME),
+// so that a new process doesn't have to read unchanged sources again to name their copies.
+void loadKnownHashes (QString mediaDirectory);
+void saveKnownHashes (QString mediaDirectory, const QStringList& sourcePaths);
+
+// Records which content-addressed files of a media directory were written by the exporter and which decks
+// use them, so that the next save copies only new content and removes files no deck refers to anymore.
+// Several decks (and sceneries) may share a media directory; see lockDirectory().
+class MediaManifest
+{
+public :
+	static const char* FILE_NAME;
+	static const char* SOURCES_FILE_NAME;
+
+	struct Entry
+	{
+		QString hash;
+		qint64 size, modified;
+
+		// Deck files using the resource; empty for entries of older manifests, which any deck may drop
+		QSet <QString> decks;
+	};
+
+	// The manifest is read, changed and written back while the returned mutex of the directory is held
+	static QMutex& lockDirectory (QString mediaDirectory);
+
+	void load (QString mediaDirectory);
+	void save (QString mediaDirectory);
+
+	// True if the file still looks exactly as it was when recorded
+	bool isUpToDate (QString name, const QFileInfo& file) const;
+	void update (QString name, QString hash, const QFileInfo& file);
+	void remove (QString name);
+
+	// Makes the deck use exactly the given resources
+	void setDeckResources (QString deckFileName, const QSet <QString>& usedNames);
+
+	// Resources no deck uses
+	QStringList orphans() const;
+
+private :
+	QMap <QString, Entry> entries;
+};
+
+#endif // MEDIA_MANIFEST_H
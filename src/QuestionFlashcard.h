@@ -8,31 +8,36 @@
 
 class QuestionFlashcard : public SimpleFlashcard
 {
-    QString question, answer, thirdSide;
+    CardText question, answer, thirdSide;
     
 public :
-    QuestionFlashcard (QString tag, VariableStackState stackState, QString question, QString answer, QString thirdSide = nullptr) :
+    QuestionFlashcard (QString tag, VariableStackState stackState, CardText question, CardText answer, CardText thirdSide = CardText()) :
         SimpleFlashcard (tag, stackState), question (question), answer (answer), thirdSide (thirdSide)
     {}
     
     QString getFrontSide()
     {
-        return question;
+        return question.toString();
     }
     
     QString getBackSide()
     {
-        return answer;
+        return answer.toString();
     }
     
     QString getThirdSide()
     {
-        return thirdSide;
+        return thirdSide.toString();
+    }
+    
+    QString getTypeName()
+    {
+        return "question";
     }
     
     bool thirdSidePresent()
     {
-        return thirdSide != nullptr;
+        return !thirdSide.isEmpty();
     }
 };
 
@@ -0,0 +1,208 @@
+#include "ResourceCopier.h"
+#include "Util.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+
+#ifndef Q_OS_LINUX
+#error This platform is not supported. Add more cases or test if the existing code works.
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace
+{
+	QString systemError (QString what, QString path)
+	{
+		return what + " '" + path + "': " + QString::fromLocal8Bit (strerror (errno));
+	}
+
+	bool copyFileRange (int sourceFd, int destinationFd, off_t size)
+	{
+#	if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+		off_t copiedTotal = 0;
+		while (copiedTotal < size)
+		{
+			ssize_t copied = copy_file_range (sourceFd, nullptr, destinationFd, nullptr, static_cast <size_t> (size - copiedTotal), 0);
+			if (copied <= 0)
+				return copied == 0 && copiedTotal == size;
+
+			copiedTotal += copied;
+		}
+		return true;
+#	else
+		(void) sourceFd; (void) destinationFd; (void) size;
+		errno = ENOSYS;
+		return false;
+#	endif
+	}
+
+	bool copyReadWrite (int sourceFd, int destinationFd)
+	{
+		if (lseek (sourceFd, 0, SEEK_SET) != 0 || lseek (destinationFd, 0, SEEK_SET) != 0 || ftruncate (destinationFd, 0) != 0)
+			return false;
+
+		char buffer[1 << 16];
+		for (;;)
+		{
+			ssize_t bytesRead = read (sourceFd, buffer, sizeof (buffer));
+			if (bytesRead < 0 && errno == EINTR) continue;
+			if (bytesRead < 0) return false;
+			if (bytesRead == 0) return true;
+
+			for (ssize_t written = 0; written < bytesRead;)
+			{
+				ssize_t chunk = write (destinationFd, buffer + written, static_cast <size_t> (bytesRead - written));
+				if (chunk < 0 && errno == EINTR) continue;
+				if (chunk < 0) return false;
+				written += chunk;
+			}
+		}
+	}
+
+	class CopyTask : public QRunnable
+	{
+	public :
+		CopyTask (ResourceCopier::CopyResult* job, bool allowHardLink) :
+			job (job), allowHardLink (allowHardLink)
+		{}
+
+		void run()
+		{
+			ResourceCopier::copyFile (*job, allowHardLink);
+		}
+
+	private :
+		ResourceCopier::CopyResult* job;
+		bool allowHardLink;
+	};
+}
+
+ResourceCopier::ResourceCopier (bool allowHardLinks, int maxParallelCopies) :
+	allowHardLinks (allowHardLinks), maxParallelCopies (maxParallelCopies)
+{
+	// Copies are mostly waiting for the disk, so allow more of them than there are cores
+	if (this->maxParallelCopies <= 0)
+		this->maxParallelCopies = qMax (4, 2 * QThread::idealThreadCount());
+}
+
+void ResourceCopier::enqueue (QString source, QString destination)
+{
+	CopyResult job;
+	job.source = source;
+	job.destination = destination;
+	job.copied = false;
+	jobs.push_back (job);
+}
+
+QVector <ResourceCopier::CopyResult> ResourceCopier::run()
+{
+	QThreadPool pool;
+	pool.setMaxThreadCount (qMin (maxParallelCopies, qMax (1, jobs.size())));
+
+	for (CopyResult& job: jobs)
+		pool.start (new CopyTask (&job, allowHardLinks));
+
+	pool.waitForDone();
+
+	QVector <CopyResult> results = jobs;
+	jobs.clear();
+	return results;
+}
+
+void ResourceCopier::copyFile (CopyResult& job, bool allowHardLink)
+{
+	QByteArray sourcePath = QFile::encodeName (job.source), destinationPath = QFile::encodeName (job.destination);
+	QByteArray destinationDirectory = QFile::encodeName (QFileInfo (job.destination).absolutePath());
+
+	struct stat sourceStat, directoryStat;
+	if (stat (sourcePath.constData(), &sourceStat) != 0)
+	{
+		job.error = systemError ("Failed to stat", job.source);
+		return;
+	}
+
+	bool sameFilesystem = stat (destinationDirectory.constData(), &directoryStat) == 0 && directoryStat.st_dev == sourceStat.st_dev;
+
+	// Never write through an old destination: it may be a hard link to some other file
+	if (unlink (destinationPath.constData()) != 0 && errno != ENOENT)
+	{
+		job.error = systemError ("Failed to remove", job.destination);
+		return;
+	}
+
+	if (sameFilesystem && allowHardLink && link (sourcePath.constData(), destinationPath.constData()) == 0)
+	{
+		job.copied = true;
+		job.method = "hard link";
+		return;
+	}
+
+	int sourceFd = open (sourcePath.constData(), O_RDONLY | O_CLOEXEC);
+	if (sourceFd < 0)
+	{
+		job.error = systemError ("Failed to open", job.source);
+		return;
+	}
+
+	int destinationFd = open (destinationPath.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, sourceStat.st_mode & 0777);
+	if (destinationFd < 0)
+	{
+		job.error = systemError ("Failed to create", job.destination);
+		close (sourceFd);
+		return;
+	}
+
+	bool copied = false;
+
+#	ifdef FICLONE
+	if (sameFilesystem && ioctl (destinationFd, FICLONE, sourceFd) == 0)
+	{
+		copied = true;
+		job.method = "reflink";
+	}
+#	endif
+
+	if (!copied && copyFileRange (sourceFd, destinationFd, sourceStat.st_size))
+	{
+		copied = true;
+		job.method = "copy_file_range";
+	}
+
+	if (!copied && copyReadWrite (sourceFd, destinationFd))
+	{
+		copied = true;
+		job.method = "read/write";
+	}
+
+	if (!copied)
+		job.error = systemError ("Failed to copy to", job.destination);
+
+	close (sourceFd);
+	if (close (destinationFd) != 0 && copied)
+	{
+		copied = false;
+		job.error = systemError ("Failed to write", job.destination);
+	}
+
+	if (copied)
+	{
+		struct timespec times[2] = { sourceStat.st_atim, sourceStat.st_mtim };
+		if (utimensat (AT_FDCWD, destinationPath.constData(), times, 0) != 0)
+		{
+			copied = false;
+			job.error = systemError ("Failed to preserve timestamps of", job.destination);
+		}
+	}
+
+	job.copied = copied;
+}
@@ -0,0 +1,38 @@
+#ifndef RESOURCE_COPIER_H
+#define RESOURCE_COPIER_H
+
+#include <QString>
+#include <QVector>
+
+// Copies deck resources in-process on a bounded pool of threads.
+// Inside one filesystem the data is shared with a reflink (or a hard link, if allowed), otherwise
+// it is copied by copy_file_range with a read/write fallback. Source timestamps are preserved.
+class ResourceCopier
+{
+public :
+	struct CopyResult
+	{
+		QString source, destination;
+		bool copied;
+
+		// Describes how the file was copied ("reflink", "hard link", ...) or why it was not
+		QString method, error;
+	};
+
+	ResourceCopier (bool allowHardLinks = false, int maxParallelCopies = 0);
+
+	void enqueue (QString source, QString destination);
+
+	// Copies all enqueued files and waits for completion; results follow the enqueue order
+	QVector <CopyResult> run();
+
+	static void copyFile (CopyResult& job, bool allowHardLink);
+
+private :
+	bool allowHardLinks;
+	int maxParallelCopies;
+
+	QVector <CopyResult> jobs;
+};
+
+#endif // RESOURCE_COPIER_H
@@ -5,10 +5,15 @@
 #include "HistoricalFlashcards.h"
 #include "QuestionFlashcard.h"
 #include "WordSpellingFlashcard.h"
+#include "StreamingDeckWriter.h"
+#include "SceneryScheduler.h"
+#include "MediaManifest.h"
+#include "FilterPredicate.h"
 
 #include <QStringList>
 #include <QFile>
 #include <QDir>
+#include <QCryptographicHash>
 
 class SceneryCommandParseException : public std::exception
 {
@@ -56,6 +61,14 @@ void SceneryCommand::parse (int commandLine, QString string)
 	}
 }
 
+void SceneryCommand::assign (QString name, QMap <QString, QString> arguments)
+{
+	this->commandLine = 0;
+	this->name = name;
+	this->arguments = arguments;
+	ignoredArguments = arguments.keys().toSet();
+}
+
 QString SceneryCommand::getArgument (QString key, QString defaultValue)
 {
 	if (arguments.count (key) > 0)
@@ -116,21 +129,501 @@ void SceneryExecutor::dump()
 		cmd.dump();
 }
 
+void SceneryExecutor::planStreaming()
+{
+	// A deck can skip keeping its rows if it is saved exactly once, after all of its exports,
+	// and its rows are never deduplicated
+	QMap <QString, int> saveCount, lastExport, firstSave;
+	QSet <QString> deduplicated;
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		// A copy, so that peeking at arguments doesn't mark them as used
+		SceneryCommand cmd = commands[i];
+		if (cmd.name != "export" && cmd.name != "save" && cmd.name != "remove_duplicates")
+			continue;
+
+		QString deckName = cmd.getArgument ("deck", "");
+		if (cmd.name == "export")
+			lastExport[deckName] = i;
+		else if (cmd.name == "remove_duplicates")
+			deduplicated.insert (deckName);
+		else if (saveCount[deckName]++ == 0)
+			firstSave[deckName] = i;
+	}
+
+	streamedDecks.clear();
+	for (QString deckName: lastExport.keys())
+		if (saveCount.value (deckName) == 1 && lastExport[deckName] < firstSave[deckName] && !deduplicated.contains (deckName))
+			streamedDecks.insert (deckName);
+}
+
+void SceneryExecutor::planParsePruning()
+{
+	// Entries of a loaded database are only needed under the tags its readers select. Sorting keeps all
+	// of them, so sorted copies are followed; any other use of the database means every tag is needed.
+	parsedTags.clear();
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		SceneryCommand load = commands[i];
+		if (load.name != "load" || load.getArgument ("strict", "false") == "true")
+			continue;
+
+		QSet <QString> family;
+		family.insert (load.getArgument ("db", ""));
+
+		ParsedTags tags;
+		bool bounded = true, used = false;
+
+		for (int j = i + 1; j < commands.size() && bounded; j++)
+		{
+			SceneryCommand cmd = commands[j];
+
+			if (cmd.name == "sort" && family.contains (cmd.getArgument ("source", "")))
+			{
+				family.insert (cmd.getArgument ("destination", ""));
+			}
+			else if (cmd.name == "filter" && family.contains (cmd.getArgument ("source", "")))
+			{
+				used = true;
+				QString tagFilter = cmd.getArgument ("tag", "*"), whereFilter = cmd.getArgument ("where", "");
+
+				QString error;
+				shared_ptr <FilterPredicate> predicate = whereFilter.isEmpty() ? nullptr : FilterPredicate::compile (whereFilter, error);
+				QStringList wherePatterns;
+
+				// -tag selects one tag by name; -where tags are wildcard patterns
+				if (tagFilter != "*")
+					tags.exactTags << tagFilter;
+				else if (predicate && predicate->getTagBound (wherePatterns))
+					tags.patterns << wherePatterns;
+				else
+					bounded = false;
+			}
+			else if (cmd.name == "split_by_tag" && family.contains (cmd.getArgument ("source", "")))
+			{
+				used = true;
+				if (cmd.getArgument ("rest", "").isEmpty())
+					for (QString pattern: cmd.getArgument ("tags", "*").split (',', QString::SkipEmptyParts))
+						tags.patterns << pattern.trimmed();
+				else
+					bounded = false;
+			}
+			else if (cmd.name != "load")
+			{
+				// Exported or otherwise read as a whole
+				for (QString key: cmd.getKeys())
+					if (family.contains (cmd.getArgument (key)))
+						bounded = false;
+			}
+		}
+
+		// An unused database is parsed completely, if only to report its errors
+		if (bounded && used)
+			parsedTags[load.getArgument ("db", "")] = tags;
+	}
+}
+
+void SceneryExecutor::loadResourceHashes()
+{
+	// Same media directories as the save command uses
+	for (QString deckPath: getSavedDeckPaths())
+	{
+		QFileInfo deckFile (deckPath);
+		QString mediaDirectory = deckFile.dir().filePath (deckFile.baseName() + "-media");
+
+		if (QFileInfo (mediaDirectory).isDir())
+			loadKnownHashes (mediaDirectory);
+	}
+}
+
 void SceneryExecutor::execute()
 {
-	for (SceneryCommand& cmd: commands)
+	planStreaming();
+	planParsePruning();
+	loadResourceHashes();
+
+	SceneryScheduler scheduler (commands);
+	scheduler.run ([this] (SceneryCommand& cmd) { executeCommandAndReport (cmd); }, QVector <bool>(), maxThreads);
+}
+
+void SceneryExecutor::executeCommandAndReport (SceneryCommand& cmd)
+{
+	executeCommand (cmd);
+
+	QString ignoredSwitches = "";
+	for (QString ignored: cmd.ignoredArguments)
+		ignoredSwitches += (ignoredSwitches.isEmpty() ? "" : ", ") + ignored;
+
+	if (!ignoredSwitches.isEmpty())
+		qstdout << "Warning: the following switches were ignored: " << ignoredSwitches << endl;
+}
+
+void SceneryExecutor::setMaxThreads (int threads)
+{
+	maxThreads = threads;
+}
+
+void SceneryExecutor::setSceneryFileName (QString fileName)
+{
+	sceneryFileName = fileName;
+}
+
+namespace
+{
+	QString fingerprintOf (QString data)
 	{
-		executeCommand (cmd);
+		return QString::fromLatin1 (QCryptographicHash::hash (data.toUtf8(), QCryptographicHash::Sha1).toHex());
+	}
 
-		QString ignoredSwitches = "";
-		for (QString ignored: cmd.ignoredArguments)
-			ignoredSwitches += (ignoredSwitches.isEmpty() ? "" : ", ") + ignored;
+	// Inputs of a command are unknown if any part of them is
+	QString combineFingerprints (QStringList parts)
+	{
+		for (QString part: parts)
+			if (part.isEmpty())
+				return "";
 
-		if (!ignoredSwitches.isEmpty())
-			qstdout << "Warning: the following switches were ignored: " << ignoredSwitches << endl;
+		return fingerprintOf (parts.join ("\n"));
 	}
 }
 
+QVector <QString> SceneryExecutor::computeFingerprints (SceneryState& state)
+{
+	QVector <QString> fingerprints (commands.size());
+	QMap <QString, QString> contentHashes, databaseFingerprints, deckFingerprints;
+	QVector < QPair <SplitDestinations, QString> > splitFingerprints;
+	QString settingsFingerprint = fingerprintOf ("settings");
+
+	// Databases made by split_by_tag are only known by their prefix and tags
+	auto databaseFingerprint = [&] (QString db) -> QString
+	{
+		if (databaseFingerprints.count (db) > 0)
+			return databaseFingerprints[db];
+
+		for (int i = splitFingerprints.size() - 1; i >= 0; i--)
+			if (splitFingerprints[i].first.mayContain (db))
+				return splitFingerprints[i].second;
+
+		return QString();
+	};
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		// A copy, so that peeking at arguments doesn't mark them as used
+		SceneryCommand cmd = commands[i];
+
+		QString arguments = cmd.name;
+		for (QString key: cmd.getKeys())
+			arguments += "\t" + key + "=" + cmd.getArgument (key);
+
+		if (cmd.name == "load")
+		{
+			QString dbName = cmd.getArgument ("db", "");
+			QStringList inputs = QStringList() << arguments;
+
+			// Files of the previous run are enough: a changed include list means a changed file
+			QStringList sourceFiles = state.getSourceFiles (dbName);
+			for (QString file: sourceFiles)
+			{
+				if (contentHashes.count (file) == 0)
+					contentHashes[file] = QFileInfo (file).isFile() ? fileContentHash (file) : "missing";
+				inputs << file + "\t" + contentHashes[file];
+			}
+
+			fingerprints[i] = sourceFiles.isEmpty() ? "" : combineFingerprints (inputs);
+			databaseFingerprints[dbName] = fingerprints[i];
+		}
+		else if (cmd.name == "filter" || cmd.name == "sort")
+		{
+			fingerprints[i] = combineFingerprints (QStringList() << arguments << databaseFingerprint (cmd.getArgument ("source", "")));
+			databaseFingerprints[cmd.getArgument ("destination", "")] = fingerprints[i];
+		}
+		else if (cmd.name == "split_by_tag")
+		{
+			fingerprints[i] = combineFingerprints (QStringList() << arguments << databaseFingerprint (cmd.getArgument ("source", "")));
+			splitFingerprints.push_back (QPair <SplitDestinations, QString> (SplitDestinations (cmd), fingerprints[i]));
+
+			if (!cmd.getArgument ("rest", "").isEmpty())
+				databaseFingerprints[cmd.getArgument ("rest", "")] = fingerprints[i];
+		}
+		else if (cmd.name == "export")
+		{
+			QString deckName = cmd.getArgument ("deck", "");
+			fingerprints[i] = combineFingerprints (QStringList() << arguments << databaseFingerprint (cmd.getArgument ("db", "")) << settingsFingerprint);
+			deckFingerprints[deckName] = combineFingerprints (QStringList() << deckFingerprints.value (deckName, fingerprintOf ("deck")) << fingerprints[i]);
+		}
+		else if (cmd.name == "remove_duplicates")
+		{
+			QString deckName = cmd.getArgument ("deck", "");
+			fingerprints[i] = combineFingerprints (QStringList() << arguments << deckFingerprints.value (deckName));
+			deckFingerprints[deckName] = fingerprints[i];
+		}
+		else if (cmd.name == "save")
+		{
+			fingerprints[i] = combineFingerprints (QStringList() << arguments << deckFingerprints.value (cmd.getArgument ("deck", "")) << settingsFingerprint);
+		}
+		else if (cmd.name.startsWith ("set_"))
+		{
+			settingsFingerprint = fingerprints[i] = combineFingerprints (QStringList() << settingsFingerprint << arguments);
+		}
+	}
+
+	return fingerprints;
+}
+
+void SceneryExecutor::executeIncrementally()
+{
+	planStreaming();
+	planParsePruning();
+	loadResourceHashes();
+
+	SceneryState state (sceneryFileName.isEmpty() ? QDir::current().filePath ("scenery") : sceneryFileName);
+	state.load();
+
+	QVector <QString> fingerprints = computeFingerprints (state);
+	QVector <bool> selected (commands.size(), false);
+
+	// Saved decks are the only results; any other command runs only if an outdated deck needs it
+	for (int i = 0; i < commands.size(); i++)
+	{
+		SceneryCommand cmd = commands[i];
+
+		if (cmd.name.startsWith ("set_"))
+		{
+			selected[i] = true;
+		}
+		else if (cmd.name == "save")
+		{
+			QString deckPath = FileReaderSingletone::instance().expandPathMacros (cmd.getArgument ("path", ""));
+			SceneryState::SavedDeck savedDeck;
+
+			if (fingerprints[i].isEmpty() || !state.findSavedDeck (deckPath, savedDeck) || savedDeck.fingerprint != fingerprints[i])
+			{
+				selected[i] = true;
+				continue;
+			}
+
+			QFileInfo deckFile (deckPath);
+			if (deckFile.exists() && deckFile.size() == savedDeck.size && deckFile.lastModified().toMSecsSinceEpoch() == savedDeck.modified)
+				qstdout << "Deck file '" << deckPath << "' is up to date." << endl;
+			else if (state.restoreSavedDeck (deckPath))
+				qstdout << "Deck file '" << deckPath << "' is up to date, restored from cache." << endl;
+			else
+				selected[i] = true;
+		}
+		else if (cmd.name != "load" && cmd.name != "filter" && cmd.name != "sort" && cmd.name != "split_by_tag" && cmd.name != "export" && cmd.name != "remove_duplicates")
+		{
+			// Nothing is known about the command's inputs and outputs
+			selected.fill (true);
+			break;
+		}
+	}
+
+	SceneryScheduler scheduler (commands);
+	for (int i = commands.size() - 1; i >= 0; i--)
+		if (selected[i])
+			for (int dependency: scheduler.getDependencies (i))
+				selected[dependency] = true;
+
+	scheduler.run ([this] (SceneryCommand& cmd) { executeCommandAndReport (cmd); }, selected, maxThreads);
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		SceneryCommand cmd = commands[i];
+		if (!selected[i] || cmd.name != "load") continue;
+
+		// A database with errors is not registered and has to be parsed again next time
+		QString dbName = cmd.getArgument ("db", "");
+		shared_ptr <FlashcardsDatabase> database = findDatabase (dbName);
+		state.setSourceFiles (dbName, database ? database->sourceFiles.toList() : QStringList());
+	}
+
+	// Parsing might have changed the lists of source files, which are part of the fingerprints
+	fingerprints = computeFingerprints (state);
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		SceneryCommand cmd = commands[i];
+		if (selected[i] && cmd.name == "save" && !fingerprints[i].isEmpty())
+			state.recordSavedDeck (FileReaderSingletone::instance().expandPathMacros (cmd.getArgument ("path", "")), fingerprints[i]);
+	}
+
+	state.save();
+}
+
+QSet <QString> SceneryExecutor::getSavedDeckPaths()
+{
+	QSet <QString> paths;
+
+	for (SceneryCommand cmd: commands)
+		if (cmd.name == "save")
+			paths.insert (QFileInfo (FileReaderSingletone::instance().expandPathMacros (cmd.getArgument ("path", ""))).absoluteFilePath());
+
+	return paths;
+}
+
+QSet <QString> SceneryExecutor::getSourceFiles()
+{
+	QMutexLocker locker (&stateMutex);
+
+	QSet <QString> files;
+	for (const QSet <QString>& databaseFiles: databaseSources)
+		files += databaseFiles;
+
+	return files;
+}
+
+void SceneryExecutor::reexecute (QSet <QString> changedFiles)
+{
+	// Follow the changes through the data flow: databases parsed from changed files and filtered from them,
+	// then every deck one of those is exported to. A deck is built from scratch, so all commands on it run again.
+	QSet <QString> changedDatabases, changedDecks;
+	QVector <bool> selected (commands.size(), false);
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		// A copy, so that peeking at arguments doesn't mark them as used
+		SceneryCommand cmd = commands[i];
+
+		if (cmd.name == "load")
+		{
+			QString dbName = cmd.getArgument ("db", "");
+			QMutexLocker locker (&stateMutex);
+
+			if (databaseSources.count (dbName) == 0 || !(databaseSources[dbName] & changedFiles).isEmpty())
+			{
+				changedDatabases.insert (dbName);
+				selected[i] = true;
+			}
+		}
+		else if (cmd.name == "filter" || cmd.name == "sort")
+		{
+			if (changedDatabases.contains (cmd.getArgument ("source", "")))
+			{
+				changedDatabases.insert (cmd.getArgument ("destination", ""));
+				selected[i] = true;
+			}
+		}
+		else if (cmd.name == "split_by_tag")
+		{
+			if (changedDatabases.contains (cmd.getArgument ("source", "")))
+			{
+				QString rest = cmd.getArgument ("rest", "");
+				if (!rest.isEmpty())
+					changedDatabases.insert (rest);
+
+				QMutexLocker locker (&stateMutex);
+				changedDatabases += splitDestinations.value (cmd.getArgument ("source", "") + "\t" + cmd.getArgument ("prefix", "")).toSet();
+				selected[i] = true;
+			}
+		}
+		else if (cmd.name == "export")
+		{
+			if (changedDatabases.contains (cmd.getArgument ("db", "")))
+				changedDecks.insert (cmd.getArgument ("deck", ""));
+		}
+		else if (cmd.name != "remove_duplicates" && cmd.name != "save" && !cmd.name.startsWith ("set_"))
+		{
+			// Nothing is known about the command's inputs and outputs
+			qstdout << "Command '" << cmd.name << "' can't be re-run alone, use a full run instead." << endl;
+			return;
+		}
+	}
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		SceneryCommand cmd = commands[i];
+		if ((cmd.name == "export" || cmd.name == "remove_duplicates" || cmd.name == "save") && changedDecks.contains (cmd.getArgument ("deck", "")))
+			selected[i] = true;
+	}
+
+	{
+		QMutexLocker locker (&stateMutex);
+		for (QString dbName: changedDatabases)
+			databases.remove (dbName);
+		for (QString deckName: changedDecks)
+			decks.remove (deckName);
+	}
+
+	qstdout << "Re-parsing " << changedDatabases.size() << " databases, re-exporting " << changedDecks.size() << " decks." << endl;
+
+	SceneryScheduler scheduler (commands);
+	scheduler.run ([this] (SceneryCommand& cmd) { executeCommandAndReport (cmd); }, selected, maxThreads);
+}
+
+void SceneryExecutor::executeSingleCommand (SceneryCommand& cmd)
+{
+	executeCommandAndReport (cmd);
+}
+
+bool SceneryExecutor::hasDatabase (QString name)
+{
+	return findDatabase (name) != nullptr;
+}
+
+shared_ptr <FlashcardsDeck> SceneryExecutor::getDeck (QString name)
+{
+	return findDeck (name);
+}
+
+void SceneryExecutor::setDeckRowSink (QString deckName, shared_ptr <DeckRowSink> sink)
+{
+	QMutexLocker locker (&stateMutex);
+	deckRowSinks[deckName] = sink;
+}
+
+bool SceneryExecutor::removeDatabase (QString name)
+{
+	QMutexLocker locker (&stateMutex);
+	databaseSources.remove (name);
+	failedDatabases.remove (name);
+	return databases.remove (name) > 0;
+}
+
+bool SceneryExecutor::removeDeck (QString name)
+{
+	QMutexLocker locker (&stateMutex);
+	return decks.remove (name) > 0;
+}
+
+shared_ptr <FlashcardsDatabase> SceneryExecutor::findDatabase (QString name)
+{
+	QMutexLocker locker (&stateMutex);
+	return databases.value (name);
+}
+
+void SceneryExecutor::addDatabase (QString name, shared_ptr <FlashcardsDatabase> database)
+{
+	database->buildIndexes();
+
+	QMutexLocker locker (&stateMutex);
+	if (databases.count (name) > 0)
+		failure ("Duplicate database '" + name + "'.");
+
+	databases[name] = database;
+	failedDatabases.remove (name);
+}
+
+shared_ptr <FlashcardsDeck> SceneryExecutor::findDeck (QString name, bool create)
+{
+	QMutexLocker locker (&stateMutex);
+	if (decks.count (name) == 0 && create)
+	{
+		shared_ptr <FlashcardsDeck> deck (new FlashcardsDeck);
+		deck->setMemoryBudget (deckMemoryBudget);
+
+		if (deckRowSinks.count (name) > 0)
+			deck->setRowSink (deckRowSinks[name]);
+		else if (streamedDecks.contains (name))
+			deck->setRowSink (shared_ptr <DeckRowSink> (new StreamingDeckWriter));
+
+		decks[name] = deck;
+	}
+
+	return decks.value (name);
+}
+
 void SceneryExecutor::executeCommand (SceneryCommand& cmd)
 {
 	/*if (cmd.name == "load_localization")
@@ -163,24 +656,50 @@ void SceneryExecutor::executeCommand (SceneryCommand& cmd)
 	if (cmd.name == "load")
 	{
 		QString dbName = cmd.getArgument ("db"), dbPath = cmd.getArgument ("path");
-		if (databases.count (dbName) > 0)
+		if (findDatabase (dbName))
 			failure ("Duplicate database '" + dbName + "'.");
 
+		{
+			QMutexLocker locker (&stateMutex);
+			failedDatabases.insert (dbName);
+		}
+
 		QPair <QString, QString> fileContents = FileReaderSingletone::instance().readContents (dbPath, "global");
 
+		{
+			// Watch mode needs at least the database file itself if parsing halts on a broken include
+			QMutexLocker locker (&stateMutex);
+			databaseSources[dbName] = QSet <QString>() << QFileInfo (fileContents.second).absoluteFilePath();
+		}
+
 		shared_ptr <DatabaseParser> parser (new DatabaseParser);
         
         parser->registerBlockParser <HistoryBlockParser> ("history");
         parser->registerBlockParser <QuestionBlockParser> ("question");
         parser->registerBlockParser <WordSpellingBlockParser> ("russian-wordspelling");
         
+		// -strict "true" parses and validates every block even if the scenery never uses its tag
+		ParsedTags tags = parsedTags.value (dbName);
+		if (cmd.getArgument ("strict", "false") != "true")
+			parser->setParsedTags (tags);
+		else
+			tags = ParsedTags();
+
 		QPair <QString, QString> globalHeaderContents = FileReaderSingletone::instance().readContents ("global.txt", DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
 		shared_ptr <FlashcardsDatabase> globalHeader = parser->parseDatabase (globalHeaderContents.second, globalHeaderContents.first, nullptr, variableStack);
         shared_ptr <FlashcardsDatabase> database = parser->parseDatabase (fileContents.second, fileContents.first, globalHeader, nullptr);
 
+		{
+			// Kept for databases with errors too, so that watch mode knows when to parse them again
+			QMutexLocker locker (&stateMutex);
+			databaseSources[dbName] = database->sourceFiles;
+		}
+
 		shared_ptr <DatabaseExporter> exporter (new DatabaseExporter (database.get()));
 
 		qstdout << "\nDatabase '" << dbName << "' loaded from '" << dbPath << "'.\n";
+		if (!tags.isEmpty())
+			qstdout << "Only blocks under tags '" << QStringList (tags.exactTags + tags.patterns).join ("', '") << "' were parsed.\n";
 		qstdout << "Parser messages:" << endl;
 		exporter->printMessages();
 
@@ -201,17 +720,30 @@ void SceneryExecutor::executeCommand (SceneryCommand& cmd)
 			return;
 		}
 
-		databases[dbName] = database;
+		addDatabase (dbName, database);
 	}
 	else if (cmd.name == "export")
 	{
 		QString dbName = cmd.getArgument ("db"), deckName = cmd.getArgument ("deck");
 
-		if (databases.count (dbName) == 0)
-			failure ("Database not found: '" + dbName + "'.");
+		shared_ptr <FlashcardsDatabase> database = findDatabase (dbName);
+		if (!database)
+		{
+			bool loadFailed = false;
+			{
+				QMutexLocker locker (&stateMutex);
+				loadFailed = failedDatabases.contains (dbName);
+			}
 
-		if (decks.count (deckName) == 0)
-            decks[deckName] = shared_ptr <FlashcardsDeck> (new FlashcardsDeck);
+			if (!loadFailed)
+				failure ("Database not found: '" + dbName + "'.");
+
+			// The load has reported why already
+			qstdout << "Database '" << dbName << "' failed to load, not exporting it to deck '" << deckName << "'." << endl;
+			return;
+		}
+
+		shared_ptr <FlashcardsDeck> deck = findDeck (deckName, true);
 
 		/*HistoricalEventExportMode eventExportMode = HistoricalEventExportMode::NAME_TO_DATE_AND_DEFINITION;
 		QString eventExportModeString = cmd.getArgument ("event-export-mode", "name-to-date-and-definition").toLower();
@@ -235,75 +767,176 @@ void SceneryExecutor::executeCommand (SceneryCommand& cmd)
 			failure ("Unknown term export mode '" + termExportModeString + "'.");
         */
 
-		shared_ptr <DatabaseExporter> exporter (new DatabaseExporter (databases[dbName].get()));
+		shared_ptr <DatabaseExporter> exporter (new DatabaseExporter (database.get()));
 
 		qstdout << "Exporting database '" + dbName + "' to deck '" + deckName + "'." << endl;
-		exporter->exportDatabase (decks[deckName].get(), variableStack->currentState());
+		exporter->exportDatabase (deck.get(), variableStack->currentState());
 	}
 	else if (cmd.name == "save")
 	{
 		QString deckName = cmd.getArgument ("deck"), fileName = cmd.getArgument ("path");
 
-		if (decks.count (deckName) == 0)
+		shared_ptr <FlashcardsDeck> deck = findDeck (deckName);
+		if (!deck)
 			failure ("No deck '" + deckName + "' found.");
 
 		if (exportDirectoryUrl.isNull())
 			failure ("Export directory URL not specified. (see set_export_directory_url)");
 
 		fileName = FileReaderSingletone::instance().expandPathMacros (fileName);
-		QFile exportTo (fileName);
-		verify (exportTo.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to open save destination file '" + fileName + "'.");
-
-		QTextStream exportStream (&exportTo);
 
-		shared_ptr <FlashcardsDeck> deck = decks[deckName];
 		qstdout << "Writing deck '" << deckName << "' to file '" << fileName << "'." << endl;
 
 		QString mediaDirectoryName = QFileInfo (fileName).baseName() + "-media";
 		deck->setMediaDirectoryName (mediaDirectoryName);
 
 		// The trailing slash is important.
-		exportStream << "*\tmedia-dir\t" << exportDirectoryUrl + mediaDirectoryName + "/" << endl;
+		if (!deck->saveDeck (fileName, exportDirectoryUrl + mediaDirectoryName + "/"))
+			qstdout << "Deck '" << deckName << "' is unchanged since the last save, file left untouched." << endl;
 
-		deck->writeDeck (exportStream);
-		deck->saveResources (fileName, true);
+		deck->saveResources (fileName, true, cmd.getArgument ("link-media", "false") == "true");
 	}
 	else if (cmd.name == "remove_duplicates")
 	{
 		QString deckName = cmd.getArgument ("deck");
 
-		if (decks.count (deckName) == 0)
+		shared_ptr <FlashcardsDeck> deck = findDeck (deckName);
+		if (!deck)
 			failure ("No deck '" + deckName + "' found.");
 
-		decks[deckName]->removeDuplicates();
+		deck->removeDuplicates();
 		qstdout << "Duplicates removed from database '" << deckName << "'." << endl;
 	}
 	else if (cmd.name == "filter")
 	{
 		QString sourceDb = cmd.getArgument ("source"), destinationDb = cmd.getArgument ("destination");
 
-		if (databases.count (sourceDb) == 0)
+		shared_ptr <FlashcardsDatabase> source = findDatabase (sourceDb);
+		if (!source)
 			failure ("Database '" + sourceDb + "' does not exist.");
 
-		if (databases.count (destinationDb) > 0)
+		if (findDatabase (destinationDb))
 			failure ("Duplicate database '" + destinationDb + "'.");
 
-        databases[destinationDb] = shared_ptr <FlashcardsDatabase> (new FlashcardsDatabase (databases[sourceDb]->variableStack));
+		// -where takes a filter expression, see FilterPredicate
+		QString tagFilter = cmd.getArgument ("tag", "*"), whereFilter = cmd.getArgument ("where", "");
+
+		// Both filters are answered from the indexes of the source; the destination only lists entry indices
+		EntryBitmap selection (source->entryCount(), true);
+
+		if (tagFilter != "*")
+		{
+			int tagId = source->tagNames.indexOf (tagFilter);
+			selection = tagId == -1 ? EntryBitmap (source->entryCount()) : source->tagBitmaps[tagId];
+		}
+
+		if (!whereFilter.isEmpty())
+		{
+			QString error;
+			shared_ptr <FilterPredicate> predicate = FilterPredicate::compile (whereFilter, error);
+			verify (predicate, "Invalid filter expression: " + error + ".");
+			selection &= predicate->evaluate (*source);
+		}
+
+		// Dated entries overlapping the range; either end may be left open
+		QString dateFrom = cmd.getArgument ("date-from", ""), dateTo = cmd.getArgument ("date-to", "");
+		if (!dateFrom.isEmpty() || !dateTo.isEmpty())
+		{
+			SimpleDate fromDate, toDate;
+			verify (dateFrom.isEmpty() || SimpleDate::parse (dateFrom, fromDate), "Invalid date '" + dateFrom + "' (expected year, month.year or day.month.year).");
+			verify (dateTo.isEmpty() || SimpleDate::parse (dateTo, toDate), "Invalid date '" + dateTo + "' (expected year, month.year or day.month.year).");
+
+			selection &= source->getDateIndex().overlapping (dateFrom.isEmpty() ? 0 : fromDate.toKey (false),
+			                                                 dateTo.isEmpty() ? ~quint32 (0) : toDate.toKey (true));
+		}
+
+		shared_ptr <FlashcardsDatabase> destination = FlashcardsDatabase::createView (source, selection.indices());
+		addDatabase (destinationDb, destination);
+		qstdout << "Database '" << sourceDb << "' filtered into '" << destinationDb << "' by tag '" << tagFilter << "'"
+		        << (whereFilter.isEmpty() ? QString() : " where '" + whereFilter + "'") << ", " << destination->entryCount() << " entries selected." << endl;
+	}
+	else if (cmd.name == "sort")
+	{
+		QString sourceDb = cmd.getArgument ("source"), destinationDb = cmd.getArgument ("destination"), sortBy = cmd.getArgument ("by", "date");
 
-		QVector <shared_ptr <SimpleFlashcard> >& sourceEntries = databases[sourceDb]->entries,
-								               & destinationEntries = databases[destinationDb]->entries;
+		shared_ptr <FlashcardsDatabase> source = findDatabase (sourceDb);
+		if (!source)
+			failure ("Database '" + sourceDb + "' does not exist.");
 
-		// More advanced filters are easy to implement, if really needed (probably date filter would be useless)
-		QString tagFilter = cmd.getArgument ("tag", "*");
+		verify (sortBy == "date", "Unknown sort key '" + sortBy + "' (only 'date' is supported).");
 
-        for (shared_ptr <SimpleFlashcard> e: sourceEntries)
+		// Chronological by begin, then by end date; undated entries keep their order after the dated ones
+		QVector <quint32> beginKeys = source->entryDateBegins, endKeys = source->entryDateEnds;
+		QVector <int> order (source->entryCount());
+		for (int i = 0; i < order.size(); i++)
 		{
-			if (tagFilter != "*" && e->getTag() != tagFilter) continue;
+			order[i] = i;
+			if (!source->datedBitmap.test (i))
+				beginKeys[i] = endKeys[i] = ~quint32 (0);
+		}
+
+		radixSortByKeys (order, endKeys);
+		radixSortByKeys (order, beginKeys);
 
-			destinationEntries.push_back (e);
+		addDatabase (destinationDb, FlashcardsDatabase::createView (source, order));
+		qstdout << "Database '" << sourceDb << "' sorted by " << sortBy << " into '" << destinationDb << "'." << endl;
+	}
+	else if (cmd.name == "split_by_tag")
+	{
+		QString sourceDb = cmd.getArgument ("source"), prefix = cmd.getArgument ("prefix", ""), restDb = cmd.getArgument ("rest", "");
+		QStringList tagPatterns = cmd.getArgument ("tags", "*").split (',', QString::SkipEmptyParts);
+
+		shared_ptr <FlashcardsDatabase> source = findDatabase (sourceDb);
+		if (!source)
+			failure ("Database '" + sourceDb + "' does not exist.");
+
+		QVector <QRegExp> tagMatchers;
+		for (QString pattern: tagPatterns)
+			tagMatchers.push_back (sharedRegExp (pattern.trimmed(), Qt::CaseSensitive, QRegExp::Wildcard));
+
+		// Destinations are decided once per distinct tag, then the entries are distributed in one pass
+		QStringList destinationNames;
+		QVector < QVector <int> > destinationIndices;
+		QVector <int> tagDestinations (source->tagNames.size(), -1);
+
+		for (int tagId = 0; tagId < source->tagNames.size(); tagId++)
+			for (QRegExp& matcher: tagMatchers)
+				if (matcher.exactMatch (source->tagNames[tagId]))
+				{
+					tagDestinations[tagId] = destinationIndices.size();
+					destinationNames << prefix + source->tagNames[tagId];
+					destinationIndices.push_back (QVector <int>());
+					break;
+				}
+
+		int restDestination = -1;
+		if (!restDb.isEmpty())
+		{
+			restDestination = destinationIndices.size();
+			destinationNames << restDb;
+			destinationIndices.push_back (QVector <int>());
+		}
+
+		for (int i = 0; i < source->entryCount(); i++)
+		{
+			int destination = tagDestinations[source->entryTagIds[i]];
+			if (destination == -1)
+				destination = restDestination;
+
+			if (destination != -1)
+				destinationIndices[destination].push_back (i);
 		}
 
-		qstdout << "Database '" << sourceDb << "' filtered into '" << destinationDb << "' by tag '" << tagFilter << "'." << endl;
+		for (int i = 0; i < destinationIndices.size(); i++)
+			addDatabase (destinationNames[i], FlashcardsDatabase::createView (source, destinationIndices[i]));
+
+		{
+			QMutexLocker locker (&stateMutex);
+			splitDestinations[sourceDb + "\t" + prefix] = destinationNames;
+		}
+
+		qstdout << "Database '" << sourceDb << "' split by tag into " << destinationIndices.size() - (restDestination != -1 ? 1 : 0) << " databases"
+		        << (restDestination != -1 ? ", the rest went to '" + restDb + "'" : QString()) << "." << endl;
 	}
 	else if (cmd.name == "set_export_directory_url")
 	{
@@ -313,6 +946,14 @@ void SceneryExecutor::executeCommand (SceneryCommand& cmd)
 		if (!exportDirectoryUrl.endsWith ("/"))
 			exportDirectoryUrl += "/";
 	}
+	else if (cmd.name == "set_memory_budget")
+	{
+		QString megabytes = cmd.getArgument ("megabytes");
+
+		bool parsed = false;
+		deckMemoryBudget = megabytes.toLongLong (&parsed) * 1024 * 1024;
+		verify (parsed && deckMemoryBudget >= 0, "Invalid memory budget '" + megabytes + "' (expected a number of megabytes, 0 for no limit).");
+	}
 	else
 	{
 		failure ("Unknown command: " + cmd.name);
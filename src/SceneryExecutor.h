@@ -7,9 +7,11 @@
 #include <QVector>
 #include <QSet>
 #include <QStringList>
+#include <QMutex>
 
 #include "FlashcardsDatabaseParser.h"
 #include "DatabaseExporter.h"
+#include "SceneryState.h"
 
 using std::shared_ptr;
 
@@ -20,6 +22,9 @@ public :
 	QSet <QString> ignoredArguments;
 
 	void parse (int commandLine, QString string);
+
+	// Makes a command from already split arguments, as if it was parsed from a scenery line
+	void assign (QString name, QMap <QString, QString> arguments);
 	QString getArgument (QString key, QString defaultValue = nullptr);
 	QStringList getKeys();
     void dump();
@@ -36,21 +41,87 @@ class SceneryExecutor
 {
 public :
 	SceneryExecutor (const QString& sceneryContents) :
-		sceneryContents (sceneryContents), exportDirectoryUrl (QString::null)
+		sceneryContents (sceneryContents), exportDirectoryUrl (QString::null), deckMemoryBudget (0), maxThreads (0)
 	{}
 
 	bool parse();
 	void execute();
 	void dump();
 
+	// Runs only the commands needed for decks whose inputs changed since the previous incremental run
+	void executeIncrementally();
+
+	// Locates the incremental state and cache; defaults to the current directory
+	void setSceneryFileName (QString fileName);
+
+	// Commands running at once, 0 for one per core
+	void setMaxThreads (int threads);
+
+	// Absolute paths of the deck files the scenery saves
+	QSet <QString> getSavedDeckPaths();
+
+	// Files the loaded databases were parsed from, including the ones that had errors
+	QSet <QString> getSourceFiles();
+
+	// Runs again only the commands affected by changes of the given files; databases and decks
+	// left from the previous run are reused. Changes of the scenery itself need a new executor.
+	void reexecute (QSet <QString> changedFiles);
+
+	// Runs one command right away, for callers feeding commands one by one
+	void executeSingleCommand (SceneryCommand& cmd);
+
+	bool hasDatabase (QString name);
+	shared_ptr <FlashcardsDeck> getDeck (QString name);
+
+	// Rows of the deck, if it is created afterwards, go to the sink instead of being kept
+	void setDeckRowSink (QString deckName, shared_ptr <DeckRowSink> sink);
+
+	// Drop what earlier commands produced; return false if there was nothing with such a name
+	bool removeDatabase (QString name);
+	bool removeDeck (QString name);
+
 private :
-	QString sceneryContents;
+	QString sceneryContents, sceneryFileName;
 	QVector <SceneryCommand> commands;
 	QString exportDirectoryUrl;
 
+	// Bytes of rows a deck may keep in memory, 0 for no limit
+	qint64 deckMemoryBudget;
+
+	int maxThreads;
+
+	// Commands run concurrently, so the maps are only accessed under the mutex
+	QMutex stateMutex;
 	QMap <QString, shared_ptr <FlashcardsDatabase> > databases;
 	QMap <QString, shared_ptr <FlashcardsDeck> > decks;
+	QMap < QString, QSet <QString> > databaseSources;
+
+	// Loaded with errors or halted while loading; exports of them are skipped
+	QSet <QString> failedDatabases;
+
+	// Databases made by every split_by_tag, by source and prefix
+	QMap <QString, QStringList> splitDestinations;
+
+	// Decks written straight to disk while exporting, see planStreaming()
+	QSet <QString> streamedDecks;
+	QMap <QString, shared_ptr <DeckRowSink> > deckRowSinks;
+
+	// Tags a loaded database has to be parsed for, see planParsePruning(); missing means every tag
+	QMap <QString, ParsedTags> parsedTags;
+
+	shared_ptr <FlashcardsDatabase> findDatabase (QString name);
+	void addDatabase (QString name, shared_ptr <FlashcardsDatabase> database);
+	shared_ptr <FlashcardsDeck> findDeck (QString name, bool create = false);
+
+	void planStreaming();
+	void planParsePruning();
+
+	// Primes the digests of resource sources recorded by previous saves into the media directories
+	void loadResourceHashes();
+	void executeCommandAndReport (SceneryCommand& cmd);
 
+	// Fingerprints of the inputs of every command, empty where the inputs are unknown
+	QVector <QString> computeFingerprints (SceneryState& state);
 	void executeCommand (SceneryCommand& cmd);
 };
 
@@ -0,0 +1,345 @@
+#include "SceneryScheduler.h"
+#include "SceneryExecutor.h"
+#include "Util.h"
+
+#include <QSet>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+
+namespace
+{
+	class FunctionTask : public QRunnable
+	{
+	public :
+		FunctionTask (std::function <void()> function) :
+			function (function)
+		{}
+
+		void run()
+		{
+			function();
+		}
+
+	private :
+		std::function <void()> function;
+	};
+}
+
+SplitDestinations::SplitDestinations (SceneryCommand cmd) :
+	prefix (cmd.getArgument ("prefix", ""))
+{
+	for (QString pattern: cmd.getArgument ("tags", "*").split (',', QString::SkipEmptyParts))
+		tagPatterns << pattern.trimmed();
+}
+
+bool SplitDestinations::mayContain (QString db) const
+{
+	if (!db.startsWith (prefix))
+		return false;
+
+	// With no prefix the destinations are the tag names themselves, so the patterns are all there is to go by
+	QString tag = db.mid (prefix.length());
+	for (QString pattern: tagPatterns)
+		if (sharedRegExp (pattern, Qt::CaseSensitive, QRegExp::Wildcard).exactMatch (tag))
+			return true;
+
+	return false;
+}
+
+QString SplitDestinations::getResource() const
+{
+	return "split:" + prefix;
+}
+
+SceneryScheduler::SceneryScheduler (QVector <SceneryCommand>& commands) :
+	commands (commands)
+{
+	buildGraph();
+}
+
+const QVector <int>& SceneryScheduler::getDependencies (int commandIndex)
+{
+	return dependencies[commandIndex];
+}
+
+QString SceneryScheduler::databaseRoot (QString db)
+{
+	if (databaseRoots.count (db) > 0)
+		return databaseRoots[db];
+
+	// Databases made by split_by_tag are only known by their prefix and tags until it runs
+	for (int i = splits.size() - 1; i >= 0; i--)
+		if (splits[i].first.mayContain (db))
+			return splits[i].second;
+
+	return db;
+}
+
+QStringList SceneryScheduler::databaseReads (QString db)
+{
+	QStringList reads = QStringList() << "db:" + db;
+	if (databaseRoots.count (db) > 0)
+		return reads;
+
+	for (QPair <SplitDestinations, QString>& split: splits)
+		if (split.first.mayContain (db))
+			reads << split.first.getResource();
+
+	return reads;
+}
+
+void SceneryScheduler::getResources (SceneryCommand cmd, QStringList& reads, QStringList& writes, bool& barrier)
+{
+	// The command is a copy: peeking at arguments mustn't mark them as used
+	barrier = false;
+
+	if (cmd.name == "load")
+	{
+		QString db = cmd.getArgument ("db", "");
+		databaseRoots[db] = db;
+		writes << "db:" + db;
+	}
+	else if (cmd.name == "filter" || cmd.name == "sort")
+	{
+		QString source = cmd.getArgument ("source", ""), destination = cmd.getArgument ("destination", "");
+		databaseRoots[destination] = databaseRoot (source);
+		reads << databaseReads (source);
+		writes << "db:" + destination;
+	}
+	else if (cmd.name == "split_by_tag")
+	{
+		QString source = cmd.getArgument ("source", ""), rest = cmd.getArgument ("rest", "");
+		QString root = databaseRoot (source);
+		reads << databaseReads (source);
+
+		SplitDestinations destinations (cmd);
+		splits.push_back (QPair <SplitDestinations, QString> (destinations, root));
+		writes << destinations.getResource();
+
+		if (!rest.isEmpty())
+		{
+			databaseRoots[rest] = root;
+			writes << "db:" + rest;
+		}
+	}
+	else if (cmd.name == "export")
+	{
+		QString db = cmd.getArgument ("db", "");
+
+		// Exporting sets fallback variables on the entries, which filtered databases share with their source
+		reads << databaseReads (db) << "settings";
+		writes << "entries:" + databaseRoot (db) << "deck:" + cmd.getArgument ("deck", "");
+	}
+	else if (cmd.name == "remove_duplicates")
+	{
+		writes << "deck:" + cmd.getArgument ("deck", "");
+	}
+	else if (cmd.name == "save")
+	{
+		reads << "settings";
+		writes << "deck:" + cmd.getArgument ("deck", "") << "file:" + cmd.getArgument ("path", "");
+	}
+	else if (cmd.name.startsWith ("set_"))
+	{
+		writes << "settings";
+	}
+	else
+	{
+		// Nothing is known about it, so keep it exactly where it is
+		barrier = true;
+	}
+}
+
+void SceneryScheduler::buildGraph()
+{
+	databaseRoots.clear();
+	splits.clear();
+
+	QMap <QString, int> lastWriter;
+	QMap < QString, QVector <int> > readersSinceWrite;
+	int lastBarrier = -1;
+
+	dependencies.clear();
+	dependencies.resize (commands.size());
+
+	for (int i = 0; i < commands.size(); i++)
+	{
+		QStringList reads, writes;
+		bool barrier = false;
+		getResources (commands[i], reads, writes, barrier);
+
+		QSet <int> waitFor;
+		if (barrier)
+			for (int j = 0; j < i; j++)
+				waitFor.insert (j);
+
+		if (lastBarrier != -1)
+			waitFor.insert (lastBarrier);
+
+		for (QString resource: reads)
+		{
+			if (lastWriter.count (resource) > 0)
+				waitFor.insert (lastWriter[resource]);
+			readersSinceWrite[resource].push_back (i);
+		}
+
+		for (QString resource: writes)
+		{
+			if (lastWriter.count (resource) > 0)
+				waitFor.insert (lastWriter[resource]);
+
+			for (int reader: readersSinceWrite[resource])
+				if (reader != i)
+					waitFor.insert (reader);
+
+			readersSinceWrite[resource].clear();
+			lastWriter[resource] = i;
+		}
+
+		if (barrier)
+			lastBarrier = i;
+
+		dependencies[i] = waitFor.toList().toVector();
+		qSort (dependencies[i]);
+	}
+}
+
+void SceneryScheduler::run (std::function <void (SceneryCommand&)> execute, QVector <bool> selected, int maxThreads)
+{
+	int numCommands = commands.size();
+	if (selected.isEmpty())
+		selected.fill (true, numCommands);
+
+	QVector <int> waitingFor (numCommands, 0);
+	QVector < QVector <int> > dependents (numCommands);
+	QVector <int> ready;
+	int remaining = 0;
+
+	for (int i = 0; i < numCommands; i++)
+	{
+		if (!selected[i]) continue;
+		remaining++;
+
+		for (int dependency: dependencies[i])
+			if (selected[dependency])
+			{
+				waitingFor[i]++;
+				dependents[dependency].push_back (i);
+			}
+
+		if (waitingFor[i] == 0)
+			ready.push_back (i);
+	}
+
+	QVector <bool> done (numCommands, false);
+	QVector <QString> outputs (numCommands), errors (numCommands);
+	int nextToPrint = 0;
+
+	QMutex mutex;
+	QWaitCondition commandDone;
+
+	// The calling thread only waits while commands run, so its capture can be written from the workers under the mutex
+	StandardStreamsCapture* callerCapture = StandardStreamsCapture::current();
+
+	// Workers never halt the process themselves: other commands may be running, and the output of finished ones
+	// may still be waiting for its turn. A failure is acted upon by the calling thread once the pool is drained.
+	bool recoverable = areFailuresRecoverable(), anyFailed = false;
+	int running = 0;
+
+	auto printOutput = [&] (int index)
+	{
+		if (callerCapture)
+			callerCapture->write (outputs[index], errors[index]);
+		else
+			writeToStandardStreams (outputs[index], errors[index]);
+		outputs[index].clear();
+		errors[index].clear();
+	};
+
+	QThreadPool pool;
+	pool.setMaxThreadCount (maxThreads > 0 ? maxThreads : QThread::idealThreadCount());
+
+	QMutexLocker locker (&mutex);
+	while (remaining > 0)
+	{
+		// Once a command failed in a run that is going to halt, only the running commands are waited for
+		if (anyFailed && !recoverable)
+		{
+			if (running == 0)
+				break;
+
+			commandDone.wait (&mutex);
+			continue;
+		}
+
+		for (int index: ready)
+		{
+			running++;
+			pool.start (new FunctionTask ([&, index] ()
+			{
+				QString output, errorOutput;
+				bool failed = false;
+				{
+					bool previousRecoverable = setRecoverableFailures (true);
+					StandardStreamsCapture capture;
+
+					try
+					{
+						execute (commands[index]);
+					}
+					catch (HaltException&)
+					{
+						failed = true;
+					}
+
+					output = capture.takeOutput();
+					errorOutput = capture.takeErrors();
+					setRecoverableFailures (previousRecoverable);
+				}
+
+				QMutexLocker taskLocker (&mutex);
+				anyFailed = anyFailed || failed;
+				outputs[index] = output;
+				errors[index] = errorOutput;
+				done[index] = true;
+				remaining--;
+				running--;
+
+				for (int dependent: dependents[index])
+					if (--waitingFor[dependent] == 0)
+						ready.push_back (dependent);
+
+				for (; nextToPrint < numCommands && (!selected[nextToPrint] || done[nextToPrint]); nextToPrint++)
+					if (selected[nextToPrint])
+						printOutput (nextToPrint);
+
+				commandDone.wakeAll();
+			}));
+		}
+		ready.clear();
+
+		if (remaining > 0)
+			commandDone.wait (&mutex);
+	}
+	locker.unlock();
+
+	pool.waitForDone();
+
+	// Commands that never ran leave gaps, the output of the ones after them is still due
+	for (; nextToPrint < numCommands; nextToPrint++)
+		if (selected[nextToPrint] && done[nextToPrint])
+			printOutput (nextToPrint);
+
+	// Throws if failures are recoverable (commands depending on a failed one have still run then), exits otherwise
+	if (anyFailed)
+	{
+		if (!recoverable)
+			StandardStreamsCapture::flushCurrent();
+		_halt();
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef SCENERY_SCHEDULER_H
+#define SCENERY_SCHEDULER_H
+
+#include <functional>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QPair>
+
+class SceneryCommand;
+
+// Databases a split_by_tag command makes, as far as they are known before it runs: the prefix followed by a tag
+// matching one of the patterns. Names made by other commands are known exactly and are never looked up here.
+class SplitDestinations
+{
+public :
+	SplitDestinations() = default;
+	SplitDestinations (SceneryCommand cmd);
+
+	bool mayContain (QString db) const;
+
+	// Splits sharing a prefix may make the same names
+	QString getResource() const;
+
+private :
+	QString prefix;
+	QStringList tagPatterns;
+};
+
+// Builds the data-flow graph of scenery commands from the databases and decks they read and write, and runs
+// commands on a pool of worker threads as soon as everything they depend on is done. Output of every command
+// is captured and printed in the scenery file order.
+class SceneryScheduler
+{
+public :
+	SceneryScheduler (QVector <SceneryCommand>& commands);
+
+	// Runs the selected commands (all if the vector is empty); dependencies that aren't selected are considered done.
+	// A failure halts only once the running commands are done and all the output is printed. With recoverable
+	// failures (see setRecoverableFailures) every command runs, and HaltException is thrown at the end instead.
+	void run (std::function <void (SceneryCommand&)> execute, QVector <bool> selected = QVector <bool>(), int maxThreads = 0);
+
+	// Earlier commands the given one has to wait for
+	const QVector <int>& getDependencies (int commandIndex);
+
+private :
+	QVector <SceneryCommand>& commands;
+	QVector < QVector <int> > dependencies;
+
+	// Databases sharing entries have a common root; split_by_tag adds the root of all its possible destinations
+	QMap <QString, QString> databaseRoots;
+	QVector < QPair <SplitDestinations, QString> > splits;
+
+	void buildGraph();
+	QString databaseRoot (QString db);
+	QStringList databaseReads (QString db);
+	void getResources (SceneryCommand cmd, QStringList& reads, QStringList& writes, bool& barrier);
+};
+
+#endif // SCENERY_SCHEDULER_H
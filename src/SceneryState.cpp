@@ -0,0 +1,125 @@
+#include "SceneryState.h"
+#include "Util.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+
+SceneryState::SceneryState (QString sceneryFileName)
+{
+	QFileInfo sceneryFile (sceneryFileName);
+	cacheDirectory = sceneryFile.dir().absoluteFilePath (".te-exporter-cache");
+	stateFileName = cacheDirectory + "/" + sceneryFile.fileName() + ".state";
+}
+
+void SceneryState::load()
+{
+	sourceFiles.clear();
+	savedDecks.clear();
+
+	QFile file (stateFileName);
+	if (!file.open (QIODevice::ReadOnly | QIODevice::Text))
+		return;
+
+	QTextStream stream (&file);
+	stream.setCodec ("UTF-8");
+
+	// A damaged state only makes the next run do more work, so unknown lines are skipped
+	while (!stream.atEnd())
+	{
+		QStringList fields = stream.readLine().split ('\t');
+
+		if (fields.size() >= 2 && fields[0] == "sources")
+		{
+			sourceFiles[fields[1]] = fields.mid (2);
+		}
+		else if (fields.size() == 5 && fields[0] == "deck")
+		{
+			SavedDeck savedDeck;
+			savedDeck.fingerprint = fields[2];
+			savedDeck.size = fields[3].toLongLong();
+			savedDeck.modified = fields[4].toLongLong();
+			savedDecks[fields[1]] = savedDeck;
+		}
+	}
+}
+
+void SceneryState::save()
+{
+	verify (QDir().mkpath (cacheDirectory), "Failed to create cache directory '" + cacheDirectory + "'.");
+
+	QFile file (stateFileName);
+	verify (file.open (QIODevice::WriteOnly | QIODevice::Text), "Failed to write scenery state '" + stateFileName + "'.");
+
+	QTextStream stream (&file);
+	stream.setCodec ("UTF-8");
+
+	for (auto it = sourceFiles.begin(); it != sourceFiles.end(); it++)
+		stream << "sources\t" << it.key() << (it.value().isEmpty() ? "" : "\t") << it.value().join ("\t") << "\n";
+
+	for (auto it = savedDecks.begin(); it != savedDecks.end(); it++)
+		stream << "deck\t" << it.key() << "\t" << it.value().fingerprint << "\t" << it.value().size << "\t" << it.value().modified << "\n";
+}
+
+QStringList SceneryState::getSourceFiles (QString databaseName)
+{
+	return sourceFiles.value (databaseName);
+}
+
+void SceneryState::setSourceFiles (QString databaseName, QStringList files)
+{
+	files.sort();
+	sourceFiles[databaseName] = files;
+}
+
+bool SceneryState::findSavedDeck (QString deckPath, SavedDeck& savedDeck)
+{
+	if (savedDecks.count (deckPath) == 0)
+		return false;
+
+	savedDeck = savedDecks[deckPath];
+	return true;
+}
+
+QString SceneryState::cachedDeckPath (QString fingerprint)
+{
+	return cacheDirectory + "/" + fingerprint + ".deck";
+}
+
+void SceneryState::recordSavedDeck (QString deckPath, QString fingerprint)
+{
+	verify (QDir().mkpath (cacheDirectory), "Failed to create cache directory '" + cacheDirectory + "'.");
+
+	QString previousFingerprint = savedDecks.value (deckPath).fingerprint;
+	if (!previousFingerprint.isEmpty() && previousFingerprint != fingerprint)
+		QFile::remove (cachedDeckPath (previousFingerprint));
+
+	QString cached = cachedDeckPath (fingerprint);
+	QFile::remove (cached);
+	verify (QFile::copy (deckPath, cached), "Failed to cache deck '" + deckPath + "' as '" + cached + "'.");
+
+	QFileInfo deckFile (deckPath);
+	SavedDeck savedDeck = { fingerprint, deckFile.size(), deckFile.lastModified().toMSecsSinceEpoch() };
+	savedDecks[deckPath] = savedDeck;
+}
+
+bool SceneryState::restoreSavedDeck (QString deckPath)
+{
+	if (savedDecks.count (deckPath) == 0)
+		return false;
+
+	QString cached = cachedDeckPath (savedDecks[deckPath].fingerprint);
+	if (!QFile::exists (cached))
+		return false;
+
+	QFile::remove (deckPath);
+	if (!QFile::copy (cached, deckPath))
+		return false;
+
+	QFileInfo deckFile (deckPath);
+	savedDecks[deckPath].size = deckFile.size();
+	savedDecks[deckPath].modified = deckFile.lastModified().toMSecsSinceEpoch();
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef SCENERY_STATE_H
+#define SCENERY_STATE_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+
+// What the previous incremental run of a scenery knew: the files every database was parsed from and
+// the fingerprints of the inputs of every saved deck. Copies of saved decks are kept in the cache
+// directory next to the state file, so that unchanged decks can be restored without running anything.
+class SceneryState
+{
+public :
+	struct SavedDeck
+	{
+		QString fingerprint;
+		qint64 size, modified;
+	};
+
+	SceneryState (QString sceneryFileName);
+
+	void load();
+	void save();
+
+	QStringList getSourceFiles (QString databaseName);
+	void setSourceFiles (QString databaseName, QStringList files);
+
+	bool findSavedDeck (QString deckPath, SavedDeck& savedDeck);
+
+	// Records the deck file as it is now and keeps its copy in the cache
+	void recordSavedDeck (QString deckPath, QString fingerprint);
+
+	// Puts the cached copy back in place of a missing or modified deck file
+	bool restoreSavedDeck (QString deckPath);
+
+private :
+	QString cacheDirectory, stateFileName;
+
+	QMap <QString, QStringList> sourceFiles;
+	QMap <QString, SavedDeck> savedDecks;
+
+	QString cachedDeckPath (QString fingerprint);
+};
+
+#endif // SCENERY_STATE_H
@@ -0,0 +1,114 @@
+#include "StreamingDeckWriter.h"
+#include "Util.h"
+
+#include <QThread>
+#include <QMutexLocker>
+
+class StreamingDeckWriter::WriterThread : public QThread
+{
+public :
+	WriterThread (StreamingDeckWriter* owner) :
+		owner (owner)
+	{}
+
+protected :
+	void run()
+	{
+		owner->writerLoop();
+	}
+
+private :
+	StreamingDeckWriter* owner;
+};
+
+StreamingDeckWriter::StreamingDeckWriter (int queueCapacity) :
+	queueCapacity (queueCapacity), finishing (false)
+{
+	verify (spool.open(), "Failed to create a temporary file for a streamed deck.");
+
+	writerThread.reset (new WriterThread (this));
+	writerThread->start();
+}
+
+StreamingDeckWriter::~StreamingDeckWriter()
+{
+	finish();
+}
+
+void StreamingDeckWriter::consumeRow (const std::vector <QString>&, const std::map <int, QString>& row)
+{
+	QString line = deckRowToLine (row);
+
+	QMutexLocker locker (&queueMutex);
+	verify (!finishing, "Row submitted to a finished deck stream.");
+
+	while (queue.size() >= queueCapacity)
+		queueNotFull.wait (&queueMutex);
+
+	queue.enqueue (line);
+	queueNotEmpty.wakeOne();
+}
+
+void StreamingDeckWriter::writerLoop()
+{
+	for (;;)
+	{
+		QQueue <QString> batch;
+		{
+			QMutexLocker locker (&queueMutex);
+			while (queue.isEmpty() && !finishing)
+				queueNotEmpty.wait (&queueMutex);
+
+			if (queue.isEmpty())
+				return;
+
+			batch = queue;
+			queue.clear();
+			queueNotFull.wakeAll();
+		}
+
+		QByteArray bytes;
+		for (const QString& line: batch)
+		{
+			bytes += line.toUtf8();
+			bytes += '\n';
+		}
+
+		if (spool.write (bytes) != bytes.size())
+		{
+			QMutexLocker locker (&queueMutex);
+			if (writeError.isEmpty())
+				writeError = spool.errorString();
+		}
+	}
+}
+
+void StreamingDeckWriter::finish()
+{
+	{
+		QMutexLocker locker (&queueMutex);
+		if (finishing)
+			return;
+
+		finishing = true;
+		queueNotEmpty.wakeAll();
+	}
+
+	writerThread->wait();
+	verify (writeError.isEmpty() && spool.flush(), "Failed to write streamed deck rows to '" + spool.fileName() + "': " + writeError);
+}
+
+void StreamingDeckWriter::writeRows (Utf8Writer& writer, int columnCount)
+{
+	finish();
+	verify (spool.seek (0), "Failed to rewind streamed deck rows in '" + spool.fileName() + "'.");
+
+	while (!spool.atEnd())
+	{
+		QByteArray line = spool.readLine();
+		if (line.endsWith ('\n'))
+			line.chop (1);
+
+		writeDeckRowLine (writer, line, columnCount);
+	}
+}
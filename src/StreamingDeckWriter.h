@@ -0,0 +1,44 @@
+#ifndef STREAMING_DECK_WRITER_H
+#define STREAMING_DECK_WRITER_H
+
+#include "DatabaseExporter.h"
+
+#include <memory>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QTemporaryFile>
+
+class QThread;
+
+// Spools deck rows to a temporary file on a background thread. Rows pass through a bounded queue,
+// so rendering overlaps with disk writes and memory use doesn't depend on the deck size.
+class StreamingDeckWriter : public DeckRowSink
+{
+public :
+	StreamingDeckWriter (int queueCapacity = 4096);
+	~StreamingDeckWriter();
+
+	void consumeRow (const std::vector <QString>& columns, const std::map <int, QString>& row);
+	void writeRows (Utf8Writer& writer, int columnCount);
+
+	// Waits until every consumed row is on disk
+	void finish();
+
+private :
+	class WriterThread;
+
+	QTemporaryFile spool;
+	std::unique_ptr <WriterThread> writerThread;
+
+	QMutex queueMutex;
+	QWaitCondition queueNotFull, queueNotEmpty;
+	QQueue <QString> queue;
+	int queueCapacity;
+	bool finishing;
+	QString writeError;
+
+	void writerLoop();
+};
+
+#endif // STREAMING_DECK_WRITER_H
@@ -0,0 +1,167 @@
+#include "TeExporter.h"
+#include "SceneryExecutor.h"
+
+#include <QDir>
+#include <QBuffer>
+
+namespace
+{
+	class CallbackRowSink : public DeckRowSink
+	{
+	public :
+		CallbackRowSink (TeExporter::RowCallback callback) :
+			callback (callback)
+		{}
+
+		void consumeRow (const std::vector <QString>& columns, const std::map <int, QString>& row)
+		{
+			QMap <QString, QString> namedRow;
+			for (auto& cell: row)
+				namedRow[columns[cell.first]] = cell.second;
+
+			callback (namedRow);
+		}
+
+		// The rows have been handed over already
+		void writeRows (Utf8Writer&, int)
+		{}
+
+	private :
+		TeExporter::RowCallback callback;
+	};
+}
+
+void InMemoryFileResolver::addFile (QString absolutePath, QString contents)
+{
+	files[QDir::cleanPath (absolutePath)] = contents;
+}
+
+bool InMemoryFileResolver::resolve (QString fileName, QStringList searchDirectories, QString& absolutePath)
+{
+	if (!QDir::isAbsolutePath (fileName))
+		for (QString directory: searchDirectories)
+		{
+			QString path = QDir::cleanPath (directory + "/" + fileName);
+			if (files.count (path) > 0)
+			{
+				absolutePath = path;
+				return true;
+			}
+		}
+
+	QString path = QDir::cleanPath (fileName);
+	if (files.count (path) == 0)
+		return false;
+
+	absolutePath = path;
+	return true;
+}
+
+bool InMemoryFileResolver::read (QString absolutePath, QString& contents)
+{
+	if (files.count (absolutePath) == 0)
+		return false;
+
+	contents = files[absolutePath];
+	return true;
+}
+
+TeExporter::TeExporter (shared_ptr <FileResolver> resolver) :
+	resolver (resolver), executor (new SceneryExecutor (""))
+{}
+
+TeExporter::~TeExporter()
+{}
+
+bool TeExporter::call (std::function <void()> function)
+{
+	bool previousRecoverable = setRecoverableFailures (true);
+	FileResolver* previousResolver = FileReaderSingletone::instance().setThreadFileResolver (resolver.get());
+	bool succeeded = true;
+
+	// Files on disk may have changed since the previous call
+	if (!resolver)
+		FileReaderSingletone::instance().invalidateFileStatus();
+
+	{
+		StandardStreamsCapture capture;
+
+		try
+		{
+			function();
+		}
+		catch (HaltException&)
+		{
+			succeeded = false;
+		}
+
+		messages += capture.takeOutput();
+		messages += capture.takeErrors();
+	}
+
+	FileReaderSingletone::instance().setThreadFileResolver (previousResolver);
+	setRecoverableFailures (previousRecoverable);
+	return succeeded;
+}
+
+bool TeExporter::load (QString dbName, QString path, QMap <QString, QString> arguments)
+{
+	arguments["db"] = dbName;
+	arguments["path"] = path;
+
+	// A database with errors is reported, but not registered
+	return execute ("load", arguments) && executor->hasDatabase (dbName);
+}
+
+bool TeExporter::filter (QString sourceDbName, QString destinationDbName, QMap <QString, QString> arguments)
+{
+	arguments["source"] = sourceDbName;
+	arguments["destination"] = destinationDbName;
+	return execute ("filter", arguments);
+}
+
+bool TeExporter::exportDeck (QString dbName, QString deckName, QMap <QString, QString> arguments)
+{
+	arguments["db"] = dbName;
+	arguments["deck"] = deckName;
+	return execute ("export", arguments);
+}
+
+bool TeExporter::execute (QString command, QMap <QString, QString> arguments)
+{
+	return call ([&] ()
+	{
+		SceneryCommand cmd;
+		cmd.assign (command, arguments);
+		executor->executeSingleCommand (cmd);
+	});
+}
+
+void TeExporter::setRowCallback (QString deckName, RowCallback callback)
+{
+	executor->setDeckRowSink (deckName, shared_ptr <DeckRowSink> (new CallbackRowSink (callback)));
+}
+
+bool TeExporter::renderDeck (QString deckName, QString& contents)
+{
+	return call ([&] ()
+	{
+		shared_ptr <FlashcardsDeck> deck = executor->getDeck (deckName);
+		if (!deck)
+			failure ("No deck '" + deckName + "' found.");
+
+		QBuffer buffer;
+		buffer.open (QIODevice::WriteOnly);
+		Utf8Writer writer (buffer);
+		deck->writeDeck (writer);
+		writer.flush();
+		contents = QString::fromUtf8 (buffer.data());
+	});
+}
+
+QString TeExporter::takeMessages()
+{
+	QString result = messages;
+	messages.clear();
+	return result;
+}
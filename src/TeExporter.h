@@ -0,0 +1,73 @@
+#ifndef TE_EXPORTER_H
+#define TE_EXPORTER_H
+
+#include <memory>
+#include <functional>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+#include "Util.h"
+
+using std::shared_ptr;
+
+class SceneryExecutor;
+
+// Serves files added to it, so that databases can be parsed without touching the disk.
+// Paths should look absolute ("/databases/history.txt"); relative names are looked up in the
+// directories of the including files and then as they are.
+class InMemoryFileResolver : public FileResolver
+{
+public :
+	void addFile (QString absolutePath, QString contents);
+
+	bool resolve (QString fileName, QStringList searchDirectories, QString& absolutePath);
+	bool read (QString absolutePath, QString& contents);
+
+private :
+	QMap <QString, QString> files;
+};
+
+// Entry point for embedding the exporter. Every instance owns its databases, decks and settings and reads
+// files through its own resolver (the file system if none is given), so instances may be used from different
+// threads at once; a single instance must not be used by two threads concurrently.
+//
+// Calls take the arguments of the scenery commands of the same name, without dashes. Failures don't halt
+// the process: the call returns false, and the reason is in the messages.
+class TeExporter
+{
+public :
+	// Column names to values of one deck row
+	typedef std::function <void (const QMap <QString, QString>& row)> RowCallback;
+
+	TeExporter (shared_ptr <FileResolver> resolver = shared_ptr <FileResolver>());
+	~TeExporter();
+
+	// A database is parsed after "global.txt", which the resolver has to supply (it may be empty)
+	bool load (QString dbName, QString path, QMap <QString, QString> arguments = QMap <QString, QString>());
+	bool filter (QString sourceDbName, QString destinationDbName, QMap <QString, QString> arguments);
+	bool exportDeck (QString dbName, QString deckName, QMap <QString, QString> arguments = QMap <QString, QString>());
+
+	// Any other scenery command
+	bool execute (QString command, QMap <QString, QString> arguments);
+
+	// Rows of a deck created afterwards are passed to the callback instead of being kept
+	void setRowCallback (QString deckName, RowCallback callback);
+
+	// The deck as it would be saved, without the media directory header
+	bool renderDeck (QString deckName, QString& contents);
+
+	// Parser messages and diagnostics accumulated since the previous call
+	QString takeMessages();
+
+private :
+	shared_ptr <FileResolver> resolver;
+	shared_ptr <SceneryExecutor> executor;
+	QString messages;
+
+	bool call (std::function <void()> function);
+
+	TeExporter (const TeExporter&) = delete;
+};
+
+#endif // TE_EXPORTER_H
@@ -0,0 +1,159 @@
+#include "Utf8.h"
+#include "Util.h"
+
+#include <QIODevice>
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+namespace
+{
+	const int WRITER_BUFFER_SIZE = 1 << 16;
+}
+
+int asciiPrefixLength (const char* data, int length)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= length; i += 16)
+	{
+		// The top bit of every byte is set for non-ASCII bytes only
+		int mask = _mm_movemask_epi8 (_mm_loadu_si128 (reinterpret_cast <const __m128i*> (data + i)));
+		if (mask != 0)
+			return i + __builtin_ctz (mask);
+	}
+#endif
+
+	for (; i < length; i++)
+		if (static_cast <unsigned char> (data[i]) >= 0x80)
+			return i;
+
+	return length;
+}
+
+bool validateUtf8 (const char* data, int length, int& errorOffset)
+{
+	const unsigned char* bytes = reinterpret_cast <const unsigned char*> (data);
+	int i = 0;
+
+	while (i < length)
+	{
+		i += asciiPrefixLength (data + i, length - i);
+		if (i >= length)
+			break;
+
+		unsigned char lead = bytes[i];
+		int continuationBytes = 0;
+		unsigned minimum = 0, codePoint = 0;
+
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			continuationBytes = 1;
+			codePoint = lead & 0x1F;
+			minimum = 0x80;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			continuationBytes = 2;
+			codePoint = lead & 0x0F;
+			minimum = 0x800;
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			continuationBytes = 3;
+			codePoint = lead & 0x07;
+			minimum = 0x10000;
+		}
+		else
+		{
+			errorOffset = i;
+			return false;
+		}
+
+		if (i + continuationBytes >= length)
+		{
+			errorOffset = i;
+			return false;
+		}
+
+		for (int j = 1; j <= continuationBytes; j++)
+		{
+			if ((bytes[i + j] & 0xC0) != 0x80)
+			{
+				errorOffset = i;
+				return false;
+			}
+
+			codePoint = (codePoint << 6) | (bytes[i + j] & 0x3F);
+		}
+
+		if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+		{
+			errorOffset = i;
+			return false;
+		}
+
+		i += continuationBytes + 1;
+	}
+
+	return true;
+}
+
+QString decodeUtf8 (const QByteArray& bytes)
+{
+	if (asciiPrefixLength (bytes.constData(), bytes.size()) == bytes.size())
+		return QString::fromLatin1 (bytes.constData(), bytes.size());
+
+	return QString::fromUtf8 (bytes.constData(), bytes.size());
+}
+
+Utf8Writer::Utf8Writer (QIODevice& device) :
+	device (device)
+{
+	buffer.reserve (WRITER_BUFFER_SIZE);
+}
+
+Utf8Writer& Utf8Writer::operator<< (const QString& text)
+{
+	buffer += text.toUtf8();
+	flushIfFull();
+	return *this;
+}
+
+Utf8Writer& Utf8Writer::operator<< (const QByteArray& bytes)
+{
+	buffer += bytes;
+	flushIfFull();
+	return *this;
+}
+
+Utf8Writer& Utf8Writer::operator<< (const char* text)
+{
+	buffer += text;
+	flushIfFull();
+	return *this;
+}
+
+Utf8Writer& Utf8Writer::operator<< (char c)
+{
+	buffer += c;
+	flushIfFull();
+	return *this;
+}
+
+void Utf8Writer::flush()
+{
+	if (buffer.isEmpty())
+		return;
+
+	verify (device.write (buffer) == buffer.size(), "Failed to write: " + device.errorString());
+	buffer.clear();
+}
+
+void Utf8Writer::flushIfFull()
+{
+	if (buffer.size() >= WRITER_BUFFER_SIZE)
+		flush();
+}
@@ -0,0 +1,40 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <QString>
+#include <QByteArray>
+
+class QIODevice;
+
+// Length of the leading run of ASCII bytes; checks 16 bytes at a time where SSE2 is available
+int asciiPrefixLength (const char* data, int length);
+
+// Checks that the bytes are well-formed UTF-8 (no overlong forms, surrogates or code points past U+10FFFF).
+// On failure the offset of the first byte of the bad sequence is returned in errorOffset.
+bool validateUtf8 (const char* data, int length, int& errorOffset);
+
+// Decodes file contents; pure ASCII, the most common case by far, is widened without decoding
+QString decodeUtf8 (const QByteArray& bytes);
+
+// Buffers UTF-8 output in front of a device. Text is encoded once; bytes that are UTF-8 already, such as
+// spooled deck rows, are copied as they are. The buffer only reaches the device in full on flush().
+class Utf8Writer
+{
+public :
+	Utf8Writer (QIODevice& device);
+
+	Utf8Writer& operator<< (const QString& text);
+	Utf8Writer& operator<< (const QByteArray& bytes);
+	Utf8Writer& operator<< (const char* text);
+	Utf8Writer& operator<< (char c);
+
+	void flush();
+
+private :
+	QIODevice& device;
+	QByteArray buffer;
+
+	void flushIfFull();
+};
+
+#endif // UTF8_H
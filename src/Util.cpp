@@ -1,16 +1,27 @@
 #include "Util.h"
+#include "Utf8.h"
 
 #include <cstdio>
+#include <sys/stat.h>
 
 #include <QString>
 #include <QStringList>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
 
-QTextStream qstdin, qstdout, qstderr;
+QTextStream qstdin, processStdout, processStderr;
 QFile stdinFile, stdoutFile, stderrFile;
 bool streamsInitialized = false;
+thread_local bool recoverableFailures = false;
+
+QMutex standardStreamsMutex;
+thread_local StandardStreamsCapture* currentCapture = nullptr;
+
+thread_local FileResolver* threadFileResolver = nullptr;
 
 void initializeStandardStreams()
 {
@@ -18,19 +29,162 @@ void initializeStandardStreams()
 	streamsInitialized = true;
 
 	stdoutFile.open (stdout, QIODevice::OpenMode (QIODevice::WriteOnly));
-	qstdout.setDevice (&stdoutFile);
-	qstdout.setCodec ("UTF-8");
+	processStdout.setDevice (&stdoutFile);
+	processStdout.setCodec ("UTF-8");
 
 	stderrFile.open (stderr, QIODevice::OpenMode (QIODevice::WriteOnly));
-	qstderr.setDevice (&stderrFile);
-	qstderr.setCodec ("UTF-8");
+	processStderr.setDevice (&stderrFile);
+	processStderr.setCodec ("UTF-8");
 
 	stdinFile.open (stdin, QIODevice::OpenMode (QIODevice::ReadOnly));
 	qstdin.setDevice (&stdinFile);
 }
 
+QTextStream& standardOutputStream()
+{
+	return currentCapture ? currentCapture->outputStream : processStdout;
+}
+
+QTextStream& standardErrorStream()
+{
+	return currentCapture ? currentCapture->errorsStream : processStderr;
+}
+
+void writeToStandardStreams (const QString& output, const QString& errors)
+{
+	QMutexLocker locker (&standardStreamsMutex);
+
+	if (!output.isEmpty())
+	{
+		processStdout << output;
+		processStdout.flush();
+	}
+
+	if (!errors.isEmpty())
+	{
+		processStderr << errors;
+		processStderr.flush();
+	}
+}
+
+StandardStreamsCapture::CaptureDevice::CaptureDevice (StandardStreamsCapture* owner, bool errors) :
+	owner (owner), errors (errors)
+{
+	open (QIODevice::WriteOnly);
+}
+
+QString StandardStreamsCapture::CaptureDevice::take()
+{
+	QString result = buffer;
+	buffer.clear();
+	return result;
+}
+
+qint64 StandardStreamsCapture::CaptureDevice::writeData (const char* data, qint64 size)
+{
+	// The stream encodes whole strings, so a chunk never ends in the middle of a character
+	QString text = QString::fromUtf8 (data, size);
+
+	if (owner->sink)
+		owner->sink (errors ? QString() : text, errors ? text : QString());
+	else
+		buffer += text;
+
+	return size;
+}
+
+StandardStreamsCapture::StandardStreamsCapture() :
+	outputDevice (this, false), errorsDevice (this, true),
+	outputStream (&outputDevice), errorsStream (&errorsDevice), previous (currentCapture)
+{
+	outputStream.setCodec ("UTF-8");
+	errorsStream.setCodec ("UTF-8");
+	currentCapture = this;
+}
+
+StandardStreamsCapture::~StandardStreamsCapture()
+{
+	currentCapture = previous;
+	sink = Sink();
+	writeToStandardStreams (takeOutput(), takeErrors());
+}
+
+void StandardStreamsCapture::setSink (Sink sink)
+{
+	outputStream.flush();
+	errorsStream.flush();
+	this->sink = sink;
+
+	QString output = outputDevice.take(), errors = errorsDevice.take();
+	if (sink && (!output.isEmpty() || !errors.isEmpty()))
+		sink (output, errors);
+}
+
+QString StandardStreamsCapture::takeOutput()
+{
+	outputStream.flush();
+	return outputDevice.take();
+}
+
+QString StandardStreamsCapture::takeErrors()
+{
+	errorsStream.flush();
+	return errorsDevice.take();
+}
+
+void StandardStreamsCapture::flushCurrent()
+{
+	if (currentCapture)
+		writeToStandardStreams (currentCapture->takeOutput(), currentCapture->takeErrors());
+}
+
+StandardStreamsCapture* StandardStreamsCapture::current()
+{
+	return currentCapture;
+}
+
+void StandardStreamsCapture::write (const QString& output, const QString& errors)
+{
+	outputStream << output;
+	errorsStream << errors;
+
+	if (sink)
+	{
+		outputStream.flush();
+		errorsStream.flush();
+	}
+}
+
+QRegExp sharedRegExp (QString pattern, Qt::CaseSensitivity caseSensitivity, QRegExp::PatternSyntax syntax)
+{
+	static QMutex mutex;
+	static QHash <QString, QRegExp> expressions;
+
+	QString key = QString::number (caseSensitivity) + ":" + QString::number (syntax) + ":" + pattern;
+	QMutexLocker locker (&mutex);
+
+	auto it = expressions.find (key);
+	if (it == expressions.end())
+	{
+		QRegExp expression (pattern, caseSensitivity, syntax);
+
+		// Copies share the compiled engine; matching first makes sure it is compiled here
+		expression.indexIn ("");
+		it = expressions.insert (key, expression);
+	}
+
+	return it.value();
+}
+
 void _condition_failure_handler (QString failureTypeString, QString failedCondition, QString file, int line, QString reason)
 {
+	// The process is about to halt: output captured by this thread must not be lost
+	if (!recoverableFailures)
+	{
+		StandardStreamsCapture::flushCurrent();
+		currentCapture = nullptr;
+	}
+
 	if (!failedCondition.isEmpty())
 		qstderr << failureTypeString << ": '" << failedCondition << "' at line " << line << " of '" << file << "'\n";
 	else
@@ -42,8 +196,28 @@ void _condition_failure_handler (QString failureTypeString, QString failedCondit
 		qstderr.flush();
 }
 
+const char* HaltException::what() const noexcept
+{
+	return "Execution halted; refer to stderr for more info.";
+}
+
+bool setRecoverableFailures (bool recoverable)
+{
+	bool previous = recoverableFailures;
+	recoverableFailures = recoverable;
+	return previous;
+}
+
+bool areFailuresRecoverable()
+{
+	return recoverableFailures;
+}
+
 void _halt()
 {
+	if (recoverableFailures)
+		throw HaltException();
+
 #	ifdef DEBUG_SOFT_HALT
 		exit (1);
 #	else
@@ -62,17 +236,36 @@ bool FileLocationMessage::operator< (const FileLocationMessage& other) const
 	return false;
 }
 
-int FileReaderSingletone::pushFileSearchPath (QString fileName, QString context)
+FileSearchPathPointer FileSearchPath::extend (FileSearchPathPointer parent, QString directory, QString context)
 {
-	includePaths.push_back (QPair <QString, QString> (fileName, context));
-	return includePaths.size();
+	return FileSearchPathPointer (new FileSearchPath (parent, directory, context));
+}
+
+QStringList FileSearchPath::getDirectories (QString context) const
+{
+	QStringList directories;
+	for (const FileSearchPath* path = this; path; path = path->parent.get())
+		if (path->context == context)
+			directories << path->directory;
+
+	return directories;
 }
 
-void FileReaderSingletone::popFileSearchPath (int pushId)
+FileResolver* FileReaderSingletone::setThreadFileResolver (FileResolver* resolver)
 {
-	verify (pushId > 0, "Non-positive push id: " + QString::number (pushId));
-	verify (includePaths.size() == pushId, "Path search stack push/pop mismatch (size is " + QString::number (includePaths.size()) + ", pop " + QString::number (pushId) + " requested).");
-	includePaths.pop_back();
+	FileResolver* previous = threadFileResolver;
+	threadFileResolver = resolver;
+	return previous;
+}
+
+FileResolver* FileReaderSingletone::getThreadFileResolver()
+{
+	return threadFileResolver;
+}
+
+void FileReaderSingletone::addGlobalFileSearchPath (QString fileName, QString context)
+{
+	globalIncludePaths.push_back (QPair <QString, QString> (fileName, context));
 }
 
 QString FileReaderSingletone::expandPathMacros (QString path)
@@ -83,43 +276,162 @@ QString FileReaderSingletone::expandPathMacros (QString path)
 	return path;
 }
 
-QString FileReaderSingletone::getAbsolutePath (QString fileName, QString context)
+QString FileReaderSingletone::getAbsolutePath (QString fileName, QString context, FileSearchPathPointer searchPath)
 {
 	fileName = expandPathMacros (fileName);
 	QString resultingPath = "";
 
 	QString searched = "";
 
+	QStringList searchDirectories;
+	if (searchPath)
+		searchDirectories = searchPath->getDirectories (context);
+
+	for (int i = globalIncludePaths.size() - 1; i >= 0; i--)
+		if (globalIncludePaths[i].second == context)
+			searchDirectories << globalIncludePaths[i].first;
+
 	QFileInfo pathInfo (fileName);
-	if (pathInfo.isAbsolute())
+	if (threadFileResolver)
+	{
+		searched = "'" + searchDirectories.join ("', '") + "'";
+		if (!threadFileResolver->resolve (fileName, searchDirectories, resultingPath))
+			resultingPath = "";
+	}
+	else if (pathInfo.isAbsolute())
 	{
 		resultingPath = pathInfo.absoluteFilePath();
 	}
 	else
 	{
-		for (int i = includePaths.size() - 1; i >= 0; i--)
-			if (includePaths[i].second == context)
-			{
-				QDir includeDirectory (includePaths[i].first);
-				if (includeDirectory.exists())
-				{
-					if (!searched.isEmpty()) searched += ", ";
-					searched += "'" + includeDirectory.absolutePath() + "'";
-					resultingPath = includeDirectory.filePath (fileName);
-					if (QFile (resultingPath).exists())
-						break;
-					resultingPath = "";
-				}
-			}
+		resultingPath = resolvePath (fileName, searchDirectories, searched);
 	}
 
 	verify (resultingPath != "", "File '" + fileName + "' could not be found in search locations for context '" + context + "' (searched " + searched + ").");
 	return resultingPath;
 }
 
-QPair <QString, QString> FileReaderSingletone::readContents (QString fileName, QString context)
+void FileReaderSingletone::invalidateFileStatus()
 {
-	QString resultingPath = getAbsolutePath (fileName, context);
+	QMutexLocker locker (&cacheMutex);
+	directoryStamps.clear();
+}
+
+qint64 FileReaderSingletone::directoryStamp (QString directory)
+{
+	// Called under cacheMutex
+	auto it = directoryStamps.find (directory);
+	if (it != directoryStamps.end())
+		return it.value();
+
+	struct stat status;
+	qint64 stamp = -1;
+	if (stat (QFile::encodeName (directory).constData(), &status) == 0 && S_ISDIR (status.st_mode))
+		stamp = qint64 (status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+
+	directoryStamps[directory] = stamp;
+	return stamp;
+}
+
+QString FileReaderSingletone::resolvePath (QString fileName, QStringList searchDirectories, QString& searched)
+{
+	QMutexLocker locker (&cacheMutex);
+
+	QString key = searchDirectories.join ("\n") + "\n\n" + fileName;
+	auto it = resolvedPaths.find (key);
+	if (it != resolvedPaths.end())
+	{
+		bool valid = true;
+		for (QPair <QString, qint64>& stamp: it.value().directoryStamps)
+			if (directoryStamp (stamp.first) != stamp.second)
+			{
+				valid = false;
+				break;
+			}
+
+		if (valid)
+		{
+			searched = it.value().searched;
+			return it.value().path;
+		}
+	}
+
+	ResolvedPath resolved;
+
+	for (QString directory: searchDirectories)
+	{
+		qint64 stamp = directoryStamp (directory);
+		resolved.directoryStamps.push_back (QPair <QString, qint64> (directory, stamp));
+		if (stamp == -1)
+			continue;
+
+		QDir includeDirectory (directory);
+		if (!searched.isEmpty()) searched += ", ";
+		searched += "'" + includeDirectory.absolutePath() + "'";
+
+		// Names with directories in them live in a subdirectory, which is the one to watch
+		QString candidate = includeDirectory.filePath (fileName), candidateDirectory = QFileInfo (candidate).absolutePath();
+		if (candidateDirectory != includeDirectory.absolutePath())
+		{
+			qint64 candidateStamp = directoryStamp (candidateDirectory);
+			resolved.directoryStamps.push_back (QPair <QString, qint64> (candidateDirectory, candidateStamp));
+			if (candidateStamp == -1)
+				continue;
+		}
+
+		struct stat status;
+		if (stat (QFile::encodeName (candidate).constData(), &status) == 0)
+		{
+			resolved.path = candidate;
+			break;
+		}
+	}
+
+	resolved.searched = searched;
+	resolvedPaths[key] = resolved;
+	return resolved.path;
+}
+
+QPair <QString, QString> FileReaderSingletone::readContents (QString fileName, QString context, FileSearchPathPointer searchPath)
+{
+	QString warnings;
+	QPair <QString, QString> result = readContents (fileName, context, searchPath, warnings);
+
+	if (!warnings.isEmpty())
+		qstderr << warnings << flush;
+
+	return result;
+}
+
+QPair <QString, QString> FileReaderSingletone::readContents (QString fileName, QString context, FileSearchPathPointer searchPath, QString& warnings)
+{
+	warnings.clear();
+	QString resultingPath = getAbsolutePath (fileName, context, searchPath);
+
+	if (threadFileResolver)
+	{
+		QString contents;
+		verify (threadFileResolver->read (resultingPath, contents), "File '" + resultingPath + "' could not be read.");
+		return QPair <QString, QString> (contents, resultingPath);
+	}
+
+	QString absolutePath = QFileInfo (resultingPath).absoluteFilePath();
+
+	// Nanosecond timestamps, so that a file rewritten within a second (e.g. in watch mode) is read again
+	struct stat status;
+	bool statusKnown = stat (QFile::encodeName (absolutePath).constData(), &status) == 0;
+	qint64 modifiedNanoseconds = statusKnown ? qint64 (status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec : 0;
+
+	if (statusKnown)
+	{
+		QMutexLocker locker (&cacheMutex);
+		auto it = cachedFiles.find (absolutePath);
+		if (it != cachedFiles.end() && it.value().size == qint64 (status.st_size) && it.value().modifiedNanoseconds == modifiedNanoseconds)
+		{
+			warnings = it.value().warnings;
+			return QPair <QString, QString> (it.value().contents, absolutePath);
+		}
+	}
 
 	QFile file (resultingPath);
 	assert (file.exists(), "File '" + resultingPath + "' could not be opened.");
@@ -128,7 +440,22 @@ QPair <QString, QString> FileReaderSingletone::readContents (QString fileName, Q
 	QByteArray fileContents = file.readAll();
 	file.close();
 
-	return QPair <QString, QString> (QString::fromUtf8 (fileContents), QFileInfo (resultingPath).absoluteFilePath());
+	// Malformed bytes would silently turn into replacement characters in the decks
+	int errorOffset = 0;
+	if (!validateUtf8 (fileContents.constData(), fileContents.size(), errorOffset))
+		warnings = "Warning: '" + absolutePath + "' is not valid UTF-8 (line " + QString::number (fileContents.left (errorOffset).count ('\n') + 1) +
+		           ", byte " + QString::number (errorOffset) + "), malformed bytes are replaced.\n";
+
+	QString contents = decodeUtf8 (fileContents);
+
+	if (statusKnown)
+	{
+		CachedFile cachedFile = { qint64 (status.st_size), modifiedNanoseconds, contents, warnings };
+		QMutexLocker locker (&cacheMutex);
+		cachedFiles[absolutePath] = cachedFile;
+	}
+
+	return QPair <QString, QString> (contents, absolutePath);
 }
 
 FileReaderSingletone& FileReaderSingletone::instance()
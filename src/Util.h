@@ -4,13 +4,86 @@
 #include <QString>
 #include <QTextStream>
 #include <QVector>
+#include <QStringList>
+#include <QRegExp>
+#include <QMap>
+#include <QHash>
+#include <QMutex>
+#include <QIODevice>
+#include <exception>
+#include <memory>
+#include <functional>
 
 /* Standard streams wrappers */
 
-extern QTextStream qstdin, qstdout, qstderr;
+extern QTextStream qstdin;
 
 void initializeStandardStreams();
 
+// Process streams, or the buffers of a StandardStreamsCapture active in the calling thread
+QTextStream& standardOutputStream();
+QTextStream& standardErrorStream();
+
+#define qstdout standardOutputStream()
+#define qstderr standardErrorStream()
+
+// Writes to the process streams at once, so that concurrent writers don't interleave
+void writeToStandardStreams (const QString& output, const QString& errors);
+
+// While alive, redirects qstdout and qstderr of the calling thread into buffers
+class StandardStreamsCapture
+{
+	friend QTextStream& standardOutputStream();
+	friend QTextStream& standardErrorStream();
+
+public :
+	typedef std::function <void (const QString& output, const QString& errors)> Sink;
+
+	StandardStreamsCapture();
+	~StandardStreamsCapture();
+
+	// Hands text to the sink as soon as a stream flushes it (at every endl) instead of buffering it
+	void setSink (Sink sink);
+
+	QString takeOutput();
+	QString takeErrors();
+
+	// Writes out whatever the calling thread has captured so far (used before halting)
+	static void flushCurrent();
+
+	// The capture active in the calling thread, if any
+	static StandardStreamsCapture* current();
+
+	// Appends text on behalf of another thread; the owner mustn't be writing at the same time
+	void write (const QString& output, const QString& errors);
+
+private :
+	// Collects what a stream flushes, or passes it on to the sink
+	class CaptureDevice : public QIODevice
+	{
+	public :
+		CaptureDevice (StandardStreamsCapture* owner, bool errors);
+
+		QString take();
+
+	protected :
+		qint64 readData (char*, qint64) { return -1; }
+		qint64 writeData (const char* data, qint64 size);
+
+	private :
+		StandardStreamsCapture* owner;
+		bool errors;
+		QString buffer;
+	};
+
+	CaptureDevice outputDevice, errorsDevice;
+	QTextStream outputStream, errorsStream;
+	Sink sink;
+	StandardStreamsCapture* previous;
+
+	StandardStreamsCapture (const StandardStreamsCapture&) = delete;
+};
+
 /* Custom assertion macros */
 
 void _condition_failure_handler (QString failureTypeString, QString failedCondition, QString file, int line, QString reason = "");
@@ -18,6 +91,18 @@ void _condition_failure_handler (QString failureTypeString, QString failedCondit
 #define DEBUG_SOFT_HALT
 void _halt();
 
+// Thrown by the failure macros instead of halting when failures are recoverable
+class HaltException : public std::exception
+{
+public :
+	const char* what() const noexcept;
+};
+
+// For long-running modes and embedding, where one failed request must not take the whole process down.
+// Applies to the calling thread; the failure message stays in its capture. Returns the previous setting.
+bool setRecoverableFailures (bool recoverable);
+bool areFailuresRecoverable();
+
 #define verify(condition, ...)    ((void)(!(condition) && (_condition_failure_handler ("Verification failed", #condition, __FILE__, __LINE__, ##__VA_ARGS__), 1) && (_halt(), 1)))
 #define failure(...)              ((void)(!(false)     && (_condition_failure_handler ("Internal failure"   , ""        , __FILE__, __LINE__, ##__VA_ARGS__), 1) && (_halt(), 1)))
 
@@ -27,6 +112,12 @@ void _halt();
 #	define assert(condition, ...) ((void)sizeof (condition))
 #endif // DEBUG_DISABLE_ASSERTIONS
 
+/* Shared caches */
+
+// Compiled expressions are shared by all threads and sceneries, so a pattern used for every line
+// of every database is compiled once
+QRegExp sharedRegExp (QString pattern, Qt::CaseSensitivity caseSensitivity = Qt::CaseSensitive, QRegExp::PatternSyntax syntax = QRegExp::RegExp);
+
 /* Common messages structures */
 
 enum class FileLocationMessageType
@@ -54,21 +145,88 @@ public :
 	bool operator< (const FileLocationMessage& other) const;
 };
 
+// Supplies files instead of the file system, e.g. from memory. Paths it returns need not exist on disk,
+// they are only used to find relative includes, to tell files apart and in messages.
+class FileResolver
+{
+public :
+	virtual ~FileResolver() {}
+
+	// Search directories are the ones of the context, most recent first. Returns false if nothing was found.
+	virtual bool resolve (QString fileName, QStringList searchDirectories, QString& absolutePath) = 0;
+	virtual bool read (QString absolutePath, QString& contents) = 0;
+};
+
+// Directories searched for the files of one parse: the directory of every file in the include chain, innermost
+// last. Never changes once made, so a chain may be shared by parses running in any threads.
+class FileSearchPath
+{
+public :
+	static std::shared_ptr <const FileSearchPath> extend (std::shared_ptr <const FileSearchPath> parent, QString directory, QString context);
+
+	// Directories of the context, innermost first
+	QStringList getDirectories (QString context) const;
+
+private :
+	std::shared_ptr <const FileSearchPath> parent;
+	QString directory, context;
+
+	FileSearchPath (std::shared_ptr <const FileSearchPath> parent, QString directory, QString context) :
+		parent (parent), directory (directory), context (context)
+	{}
+};
+
+typedef std::shared_ptr <const FileSearchPath> FileSearchPathPointer;
+
 class FileReaderSingletone
 {
 public :
-	int pushFileSearchPath (QString fileName, QString context);
-	void popFileSearchPath (int pushId);
+	// Files of the calling thread are taken from the resolver while it is set; returns the previous one
+	FileResolver* setThreadFileResolver (FileResolver* resolver);
+	FileResolver* getThreadFileResolver();
+
+	// Global paths are searched after the ones of the search path; add them before anything is read
+	void addGlobalFileSearchPath (QString fileName, QString context);
 
-	// Returns contents & absolute resulting file path
-	QPair <QString, QString> readContents (QString fileName, QString context);
+	// Returns contents & absolute resulting file path; warnings about the contents are printed
+	QPair <QString, QString> readContents (QString fileName, QString context, FileSearchPathPointer searchPath = FileSearchPathPointer());
+
+	// The same, leaving warnings (e.g. about malformed UTF-8) to the caller. They are given on every read of the file.
+	QPair <QString, QString> readContents (QString fileName, QString context, FileSearchPathPointer searchPath, QString& warnings);
 
 	QString expandPathMacros (QString path);
-	QString getAbsolutePath (QString fileName, QString context);
+	QString getAbsolutePath (QString fileName, QString context, FileSearchPathPointer searchPath = FileSearchPathPointer());
+
+	// Forgets the directory status used to trust resolved paths; found and missing files are looked up again
+	// on the next use if their directories changed. Call when files may have changed since the last run.
+	void invalidateFileStatus();
 
 	static FileReaderSingletone& instance();
 private :
-	QVector < QPair <QString, QString> > includePaths;
+	QVector < QPair <QString, QString> > globalIncludePaths;
+
+	// Contents of files read so far, checked against the file status before being reused
+	struct CachedFile
+	{
+		qint64 size, modifiedNanoseconds;
+		QString contents, warnings;
+	};
+
+	// A resolved path (empty if the file wasn't found) holds while the directories that were looked into
+	// keep their modification times, as a file can only appear or vanish by changing its directory
+	struct ResolvedPath
+	{
+		QString path, searched;
+		QVector < QPair <QString, qint64> > directoryStamps;
+	};
+
+	QMutex cacheMutex;
+	QMap <QString, CachedFile> cachedFiles;
+	QHash <QString, ResolvedPath> resolvedPaths;
+	QHash <QString, qint64> directoryStamps;
+
+	qint64 directoryStamp (QString directory);
+	QString resolvePath (QString fileName, QStringList searchDirectories, QString& searched);
 
 	FileReaderSingletone() {}
 	FileReaderSingletone (const FileReaderSingletone&) = delete;
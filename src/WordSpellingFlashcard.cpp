@@ -1,5 +1,7 @@
 #include "WordSpellingFlashcard.h"
 #include "QuestionFlashcard.h"
+#include "WordSpellingMarkup.h"
+#include "Log.h"
 
 bool isVowel (QChar c)
 {
@@ -15,58 +17,6 @@ bool isVowel (QChar c)
 
 void WordSpellingBlockParser::parseWord (QString word, QString& outQuestion, QString& outAnswer, QString& outThirdSide)
 {
-    struct Word
-    {
-        QString test, answer;
-        QList <int> insertStressPositions;
-
-        Word (const QString& test_ = "", const QString& answer_ = "") :
-            test (test_), answer (answer_)
-        {}
-
-        Word& append (const QString& a, const QString& b)
-        {
-            test += a;
-            answer += b;
-            return *this;
-        }
-
-        Word& append (const QChar& x)
-        {
-            test += x;
-            answer += x;
-            return *this;
-        }
-
-        Word& append (const Word& other)
-        {
-            append (other.test, other.answer);
-
-            for (int i = 0; i < other.insertStressPositions.size(); i++)
-                insertStressPositions.push_back (test.size() + other.insertStressPositions[i]);
-
-            return *this;
-        }
-
-        void insertStress()
-        {
-            insertStressPositions.push_back (test.size() - 1);
-        }
-
-        QString trimTest (QChar expected)
-        {
-            verify (test.size() > 0);
-            verify (test[0] == expected);
-
-            return test.right (test.size() - 1);
-        }
-    };
-
-    std::vector <Word> stack;
-    stack.push_back (Word ("", ""));
-
-    bool escaped = false;
-    
     int answerCommentBegin = word.indexOf ("*");
     QString answerComment = "";
     if (answerCommentBegin >= 0)
@@ -75,109 +25,26 @@ void WordSpellingBlockParser::parseWord (QString word, QString& outQuestion, QSt
         word = word.left (answerCommentBegin);
     }
     
-    for (unsigned i = 0; i < word.length(); i++)
-    {
-        if (word[i] == '\\')
-        {
-            escaped = true;
-            continue;
-        }
-
-        if (escaped)
-        {
-            stack.back().append (word[i]);
-            escaped = false;
-            continue;
-        }
-
-        if (word[i] == '(')
-        {
-            stack.push_back (Word ("(", ""));
-        }
-        else if (word[i] == ')')
-        {
-            verify (stack.size() > 1);
-            QString inside = stack.back().answer;
-            stack.pop_back();
-            stack.back().append ("<font color=#FF0000>..</font>", inside);
-            outAnswer += inside;
-        }
-        else if (word[i] == '[')
-        {
-            stack.push_back (Word ("[", ""));
-        }
-        else if (word[i] == ']')
-        {
-            verify (i + 1 < word.length());
-            verify (stack.size() > 1);
-
-            QString inside = stack.back().trimTest ('['), answer = stack.back().answer;
-            stack.pop_back();
-
-            QChar next = word[++i];
-            if (next != ' ' && next != '-')
-            {
-                stack.back().append (Word ("(", answer).append (inside, "").append (") ", ""));
-                i--;
-            }
-            else
-            {
-                stack.back().append (Word ("(", answer + next).append (inside, "").append (") ", ""));
-            }
-        }
-        else if (word[i] == '{')
-        {
-            stack.push_back (Word ("{", ""));
-        }
-        else if (word[i] == '}')
-        {
-            verify (stack.size() > 1);
-
-            QString inside = stack.back().trimTest ('{');
-            stack.pop_back();
-            stack.back().append (Word ("<i><font color=#969696>(", "").append (inside, "").append (")</font></i>", ""));
-        }
-        else if (word[i] == '`')
-        {
-            verify (i + 1 < word.length());
-            QChar stressed = word[++i];
-            stack.back().append (Word (QString (stressed), "<font color=#FF0000>").append ("", QString (stressed)).append ("", "&#769;</font>"));
-            stack.back().insertStress();
-        }
-        else if (word[i] == '!')
-        {
-            stack.back().append ("<font color=#FF0000>..</font>", "");
-        }
-        else if (word[i] == '^')
-        {
-            verify (i + 1 < word.length());
-            QChar capitalized = word[++i];
-            bool isCapitalized = capitalized != capitalized.toLower();
-            Word prefix = Word ("<font color=#969696>", (isCapitalized ? "<font color=#FF0000>" : ""));
-            stack.back().append (prefix.append (QString (capitalized.toLower()), QString (capitalized)).append (Word ("</font>", isCapitalized ? "</font>" : "")));
-            stack.back().insertStress();
-        }
-        else
-        {
-            stack.back().append (word[i]);
-        }
-    }
-
-    verify (stack.size() == 1);
-    //Word output = Word ("<font size=20>", "").append (stack.back()).append ("</font>", "");
-    Word output = Word ("<center>", "").append (stack.back()).append ("</center>", "");
+    QString question, answer;
+    if (compileWordMarkup (word, markupProgram))
+        renderWordMarkup (markupProgram, question, answer);
+    else
+        renderWordMarkupByStack (word, question, answer);
+    
+    //question = "<font size=20>" + question + "</font>";
+    question = "<center>" + question + "</center>";
     if (!answerComment.isEmpty())
     {
         if (answerComment[0] == ' ')
-            output = output.append ("", "<i><font color=#969696>(" + answerComment.trimmed() + ")</font></i>");
+            answer += "<i><font color=#969696>(" + answerComment.trimmed() + ")</font></i>";
         else
         {
             // TODO: commas support
             outThirdSide = getRuleReference (answerComment);
         }
     }
-    outQuestion = output.test.trimmed();
-    outAnswer = output.answer.trimmed();
+    outQuestion = question.trimmed();
+    outAnswer = answer.trimmed();
 }
 
 bool WordSpellingBlockParser::acceptsBlock (const QVector <QString>&)
@@ -198,14 +65,22 @@ void WordSpellingBlockParser::parseBlock (QVector <QString>& block)
         QString question, answer, thirdSide;
         parseWord (line, question, answer, thirdSide);
         
-        QString preamble = currentDatabase->variableStack->currentState().getVariableValue ("russian_word_spelling_preamble");
-        if (!preamble.isEmpty())
-            question += preamble;
+        // The preamble and the rule reference are shared by all the words using them
+        CardText front (question);
+        front += currentDatabase->variableStack->currentState().getVariableValue ("russian_word_spelling_preamble");
         
-        currentDatabase->entries.push_back (shared_ptr <SimpleFlashcard> (new QuestionFlashcard (currentEntryTag, currentDatabase->variableStack->currentState(), question, answer, thirdSide)));
+        currentDatabase->entries.push_back (shared_ptr <SimpleFlashcard> (new QuestionFlashcard (currentEntryTag, currentDatabase->variableStack->currentState(), front, answer, thirdSide)));
     }
 }
 
+void WordSpellingBlockParser::skipBlock (QVector <QString>& block)
+{
+    // Words of any tag may refer to the rules, so the rules are always read
+    for (QString line: block)
+        if (!line.isEmpty() && line[0] == '*')
+            processRuleLine (line);
+}
+
 void WordSpellingBlockParser::processRuleLine (QString ruleLine)
 {
     bool attemptPoint = !ruleLine.isEmpty() && ruleLine[0] == '*';
@@ -224,7 +99,7 @@ void WordSpellingBlockParser::processRuleLine (QString ruleLine)
             {        
                 QString rest = ruleLine.right (ruleLine.length() - firstSpace - 1);
                 
-                qstdout << "Proceeding to point " << rulePoint << endl;
+                logDebug ("rules", "Proceeding to point " + rulePoint);
                 currentRulePoint = rulePoint;
                 processRuleLine (rest);
                 return;
@@ -232,44 +107,77 @@ void WordSpellingBlockParser::processRuleLine (QString ruleLine)
         }
     }
     
-    qstdout << ruleLine << endl;
+    logDebug ("rules", ruleLine);
+    logTrace ("rules", "Rule tree:\n" + ruleTreeRoot.dump());
     
-    ruleTreeRoot.dump();
-    RuleTree* node = ruleTreeRoot.walkTree (currentRulePoint, true);
+    RuleTree* node = findRule (currentRulePoint, true);
     Q_ASSERT (node);
     
-    if (node->contents.isEmpty())
-        node->contents = ruleLine;
-    else
-        node->contents = node->contents + "\n" + ruleLine;
+    node->appendContents (ruleLine);
+    ruleReferences.clear();
+}
+
+RuleTree* WordSpellingBlockParser::findRule (QString rulePath, bool create)
+{
+    auto it = rulesByPath.find (rulePath);
+    if (it != rulesByPath.end())
+        return it.value();
+    
+    RuleTree* node = ruleTreeRoot.walkTree (rulePath, create);
+    if (node)
+        rulesByPath[rulePath] = node;
+    
+    return node;
 }
 
 QString WordSpellingBlockParser::getRuleReference (QString rulePoint)
 {
-    ruleTreeRoot.dump();
+    auto cached = ruleReferences.find (rulePoint);
+    if (cached != ruleReferences.end())
+        return cached.value();
+    
+    logTrace ("rules", "Rule tree:\n" + ruleTreeRoot.dump());
     
     int dotIndex = rulePoint.indexOf ('.');
     QString walkFrom = (dotIndex == -1 ? rulePoint : rulePoint.left (dotIndex));
     QString remainingRulePoint = (dotIndex == -1 ? "" : rulePoint.right (rulePoint.length() - dotIndex - 1));
-    RuleTree* node = ruleTreeRoot.walkTree (walkFrom, false);
+    RuleTree* node = findRule (walkFrom, false);
     Q_ASSERT (node);
     QString rule = node->formatSubtree ("", remainingRulePoint);
     rule = "<size .3>" + rule + "</size>";
+    
+    ruleReferences[rulePoint] = rule;
     return rule;
 }
 
+void RuleTree::appendContents (QString line)
+{
+    contents = contents.isEmpty() ? line : contents + "\n" + line;
+    escapedContentsValid = false;
+}
+
+QString RuleTree::getEscapedContents()
+{
+    if (!escapedContentsValid)
+    {
+        escapedContents = escapeRulePart (contents + (contents.isEmpty() ? "" : "\n"));
+        escapedContentsValid = true;
+    }
+    
+    return escapedContents;
+}
+
 QString RuleTree::formatSubtree (QString currentPoint, QString highlightPoint)
 {
-    QString subtree = contents + (contents.isEmpty() ? "" : "\n");
-    subtree = escapeRulePart (subtree);
+    QString subtree = getEscapedContents();
     
     // Print highlighted entries first  
     for (int iteration = 0; iteration < 2; iteration++)
-        for (RuleTree& child: children)
+        for (shared_ptr <RuleTree>& child: children)
         {
-            QString childPath = child.getRulePath (currentPoint);
+            QString childPath = child->getRulePath (currentPoint);
             if (highlightPoint.startsWith (childPath) == 1 - iteration)
-                subtree += child.formatSubtree (child.getRulePath (currentPoint), highlightPoint);
+                subtree += child->formatSubtree (childPath, highlightPoint);
         
         }
     if (!currentPoint.isEmpty())
@@ -342,21 +250,17 @@ RuleTree* RuleTree::walkTree (QString rulePoint, bool create)
         rulePoint = rulePoint.left (firstDot);
     }
     
-    qstdout << "Finding " << rulePoint << endl;
-    qstdout << "Has " << children.size() << " children" << endl;
-    for (RuleTree& subtree: children)
-        if (subtree.comeBy == rulePoint)
-        {
-            qstdout << "Proceeding to " << rulePoint << endl;
-            return subtree.walkTree (proceed, create);
-        }
-    
-    qstdout << "Creating " << rulePoint << endl;
+    logTrace ("rules", "Finding " + rulePoint + ", " + QString::number (children.size()) + " children");
+    auto child = childrenByName.find (rulePoint);
+    if (child != childrenByName.end())
+        return child.value()->walkTree (proceed, create);
     
     if (create)
     {
-        children.push_back (RuleTree (rulePoint));
-        return children.back().walkTree (proceed, create);
+        logTrace ("rules", "Creating " + rulePoint);
+        children.push_back (shared_ptr <RuleTree> (new RuleTree (rulePoint)));
+        childrenByName[rulePoint] = children.back().get();
+        return children.back()->walkTree (proceed, create);
     }
     else
     {
@@ -366,11 +270,12 @@ RuleTree* RuleTree::walkTree (QString rulePoint, bool create)
 
 #include "Util.h"
 
-void RuleTree::dump (QString path)
+QString RuleTree::dump (QString path)
 {
-    qstderr << path << ". " << contents << " " << children.size() << " children\n";
-    qstderr.flush();
+    QString result = path + ". " + contents + " " + QString::number (children.size()) + " children\n";
+    
+    for (shared_ptr <RuleTree>& child: children)
+        result += child->dump (child->getRulePath (path));
     
-    for (RuleTree& child: children)
-        child.dump (child.getRulePath (path));
+    return result;
 }
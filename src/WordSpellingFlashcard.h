@@ -3,19 +3,25 @@
 
 #include "FlashcardsDatabase.h"
 #include "FlashcardsDatabaseParser.h"
+#include "WordSpellingMarkup.h"
 
 #include <QString>
+#include <QHash>
 
 class RuleTree
 {
 public :
     QString comeBy, contents;
-    QVector <RuleTree> children;
+    
+    // Shared pointers keep nodes in place, so that they can be indexed
+    QVector < shared_ptr <RuleTree> > children;
     
     RuleTree (QString comeBy = "") :
-        comeBy (comeBy), contents ("")
+        comeBy (comeBy), contents (""), escapedContentsValid (false)
     {}
     
+    void appendContents (QString line);
+    
     QString getRulePath (QString parentPath)
     {
         return parentPath.isEmpty() ? comeBy : parentPath + "." + comeBy;
@@ -25,12 +31,20 @@ public :
     
     RuleTree* walkTree (QString rulePoint, bool create);
     
-    void dump (QString path = "");
+    QString dump (QString path = "");
     
     // For better detection of broken paired contructions, invoke on partial strings
     QString escapeRulePart (QString ruleString);
     
     QString replacePaired (QString string, QChar pairSymbol, QString oddReplaceWith, QString evenReplaceWith);
+    
+private :
+    QHash <QString, RuleTree*> childrenByName;
+    
+    QString escapedContents;
+    bool escapedContentsValid;
+    
+    QString getEscapedContents();
 };
 
 class WordSpellingBlockParser : public BlockParser
@@ -42,11 +56,21 @@ public :
     
     bool acceptsBlock (const QVector <QString>& block);
     void parseBlock (QVector <QString>& block);
+    void skipBlock (QVector <QString>& block);
     
 private :
     RuleTree ruleTreeRoot;
     QString currentRulePoint;
     
+    // Nodes by full rule path, and rendered references by rule point (the rule and the highlighted point in it);
+    // any new rule line may change a rendering, so the references are forgotten then
+    QHash <QString, RuleTree*> rulesByPath;
+    QHash <QString, QString> ruleReferences;
+    
+    // Reused by every word, so that its buffer is allocated once
+    QVector <WordMarkupToken> markupProgram;
+    
+    RuleTree* findRule (QString rulePath, bool create);
     void processRuleLine (QString ruleLine);
     QString getRuleReference (QString rulePoint);
     
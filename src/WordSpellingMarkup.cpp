@@ -0,0 +1,345 @@
+#include "WordSpellingMarkup.h"
+#include "Util.h"
+
+#include <vector>
+#include <QPair>
+
+namespace
+{
+    enum class SymbolClass : quint8
+    {
+        LITERAL,
+        ESCAPE,
+        OPEN,
+        CLOSE,
+        STRESS,
+        GAP,
+        CAPITAL
+    };
+    
+    SymbolClass classify (QChar c)
+    {
+        static const std::vector <SymbolClass> table = [] ()
+        {
+            std::vector <SymbolClass> classes (128, SymbolClass::LITERAL);
+            classes['\\'] = SymbolClass::ESCAPE;
+            classes['('] = classes['['] = classes['{'] = SymbolClass::OPEN;
+            classes[')'] = classes[']'] = classes['}'] = SymbolClass::CLOSE;
+            classes['`'] = SymbolClass::STRESS;
+            classes['!'] = SymbolClass::GAP;
+            classes['^'] = SymbolClass::CAPITAL;
+            return classes;
+        } ();
+        
+        return c.unicode() < 128 ? table[c.unicode()] : SymbolClass::LITERAL;
+    }
+    
+    WordMarkupToken makeToken (WordMarkupToken::Kind kind, QChar symbol, QChar operand = QChar())
+    {
+        WordMarkupToken token = { kind, symbol, operand, -1 };
+        return token;
+    }
+    
+    const QLatin1String GAP_MARKUP ("<font color=#FF0000>..</font>"),
+                        STRESS_BEGIN ("<font color=#FF0000>"), STRESS_END ("&#769;</font>"),
+                        CAPITAL_BEGIN ("<font color=#FF0000>"), CAPITAL_END ("</font>"),
+                        LOWERCASE_BEGIN ("<font color=#969696>"), LOWERCASE_END ("</font>"),
+                        REMARK_BEGIN ("<i><font color=#969696>("), REMARK_END (")</font></i>");
+}
+
+bool compileWordMarkup (const QString& word, QVector <WordMarkupToken>& program)
+{
+    program.clear();
+    program.reserve (word.size());
+    
+    QVector <int> openBrackets;
+    int length = word.size();
+    
+    for (int i = 0; i < length; i++)
+    {
+        QChar c = word[i];
+        
+        switch (classify (c))
+        {
+            case SymbolClass::LITERAL:
+                program.push_back (makeToken (WordMarkupToken::Kind::TEXT, c));
+                break;
+            
+            case SymbolClass::ESCAPE:
+                // A backslash doesn't escape another one: the first character after the run is taken as it is
+                while (i < length && word[i] == '\\')
+                    i++;
+                
+                if (i < length)
+                    program.push_back (makeToken (WordMarkupToken::Kind::TEXT, word[i]));
+                break;
+            
+            case SymbolClass::OPEN:
+                openBrackets.push_back (program.size());
+                program.push_back (makeToken (WordMarkupToken::Kind::OPEN, c));
+                break;
+            
+            case SymbolClass::CLOSE:
+            {
+                if (openBrackets.isEmpty() || (c == ']' && i + 1 >= length))
+                    return false;
+                
+                // Anything may be closed by ')', the others only close their own kind
+                int open = openBrackets.back();
+                QChar opening = program[open].symbol;
+                if ((c == ']' && opening != '[') || (c == '}' && opening != '{'))
+                    return false;
+                
+                openBrackets.pop_back();
+                WordMarkupToken token = makeToken (WordMarkupToken::Kind::CLOSE, c);
+                token.partner = open;
+                
+                if (c == ']' && (word[i + 1] == ' ' || word[i + 1] == '-'))
+                    token.operand = word[++i];
+                
+                program[open].partner = program.size();
+                program.push_back (token);
+                break;
+            }
+            
+            case SymbolClass::STRESS:
+            case SymbolClass::CAPITAL:
+                if (i + 1 >= length)
+                    return false;
+                
+                program.push_back (makeToken (classify (c) == SymbolClass::STRESS ? WordMarkupToken::Kind::STRESS : WordMarkupToken::Kind::CAPITAL, c, word[i + 1]));
+                i++;
+                break;
+            
+            case SymbolClass::GAP:
+                program.push_back (makeToken (WordMarkupToken::Kind::GAP, c));
+                break;
+            
+            default:
+                failure ("Unknown markup symbol class.");
+                return false;
+        }
+    }
+    
+    return openBrackets.isEmpty();
+}
+
+void renderWordMarkup (const QVector <WordMarkupToken>& program, QString& question, QString& answer)
+{
+    question.clear();
+    answer.clear();
+    question.reserve (program.size() * 2);
+    answer.reserve (program.size() * 2);
+    
+    // Whether the text at the current depth reaches each side
+    bool toQuestion = true, toAnswer = true;
+    QVector < QPair <bool, bool> > enclosing;
+    
+    for (const WordMarkupToken& token: program)
+        switch (token.kind)
+        {
+            case WordMarkupToken::Kind::TEXT:
+                if (toQuestion) question += token.symbol;
+                if (toAnswer) answer += token.symbol;
+                break;
+            
+            case WordMarkupToken::Kind::OPEN:
+            {
+                QChar closing = program[token.partner].symbol;
+                if (toQuestion && closing == ']') question += '(';
+                if (toQuestion && closing == '}') question += REMARK_BEGIN;
+                
+                // Contents of "(..)" only go to the answer, of "{..}" only to the question
+                enclosing.push_back (QPair <bool, bool> (toQuestion, toAnswer));
+                toQuestion = toQuestion && closing != ')';
+                toAnswer = toAnswer && closing != '}';
+                break;
+            }
+            
+            case WordMarkupToken::Kind::CLOSE:
+                toQuestion = enclosing.back().first;
+                toAnswer = enclosing.back().second;
+                enclosing.pop_back();
+                
+                if (token.symbol == ')')
+                {
+                    if (toQuestion) question += GAP_MARKUP;
+                }
+                else if (token.symbol == ']')
+                {
+                    if (toQuestion) question += ") ";
+                    if (toAnswer && !token.operand.isNull()) answer += token.operand;
+                }
+                else
+                {
+                    if (toQuestion) question += REMARK_END;
+                }
+                break;
+            
+            case WordMarkupToken::Kind::STRESS:
+                if (toQuestion) question += token.operand;
+                if (toAnswer) answer += STRESS_BEGIN + QString (token.operand) + STRESS_END;
+                break;
+            
+            case WordMarkupToken::Kind::GAP:
+                if (toQuestion) question += GAP_MARKUP;
+                break;
+            
+            case WordMarkupToken::Kind::CAPITAL:
+            {
+                bool isCapitalized = token.operand != token.operand.toLower();
+                if (toQuestion) question += LOWERCASE_BEGIN + QString (token.operand.toLower()) + LOWERCASE_END;
+                if (toAnswer) answer += isCapitalized ? CAPITAL_BEGIN + QString (token.operand) + CAPITAL_END : QString (token.operand);
+                break;
+            }
+            
+            default:
+                failure ("Unknown word markup token.");
+        }
+}
+
+void renderWordMarkupByStack (QString word, QString& outQuestion, QString& outAnswer)
+{
+    struct Word
+    {
+        QString test, answer;
+        QList <int> insertStressPositions;
+
+        Word (const QString& test_ = "", const QString& answer_ = "") :
+            test (test_), answer (answer_)
+        {}
+
+        Word& append (const QString& a, const QString& b)
+        {
+            test += a;
+            answer += b;
+            return *this;
+        }
+
+        Word& append (const QChar& x)
+        {
+            test += x;
+            answer += x;
+            return *this;
+        }
+
+        Word& append (const Word& other)
+        {
+            append (other.test, other.answer);
+
+            for (int i = 0; i < other.insertStressPositions.size(); i++)
+                insertStressPositions.push_back (test.size() + other.insertStressPositions[i]);
+
+            return *this;
+        }
+
+        void insertStress()
+        {
+            insertStressPositions.push_back (test.size() - 1);
+        }
+
+        QString trimTest (QChar expected)
+        {
+            verify (test.size() > 0);
+            verify (test[0] == expected);
+
+            return test.right (test.size() - 1);
+        }
+    };
+
+    std::vector <Word> stack;
+    stack.push_back (Word ("", ""));
+
+    bool escaped = false;
+    
+    for (unsigned i = 0; i < word.length(); i++)
+    {
+        if (word[i] == '\\')
+        {
+            escaped = true;
+            continue;
+        }
+
+        if (escaped)
+        {
+            stack.back().append (word[i]);
+            escaped = false;
+            continue;
+        }
+
+        if (word[i] == '(')
+        {
+            stack.push_back (Word ("(", ""));
+        }
+        else if (word[i] == ')')
+        {
+            verify (stack.size() > 1);
+            QString inside = stack.back().answer;
+            stack.pop_back();
+            stack.back().append ("<font color=#FF0000>..</font>", inside);
+        }
+        else if (word[i] == '[')
+        {
+            stack.push_back (Word ("[", ""));
+        }
+        else if (word[i] == ']')
+        {
+            verify (i + 1 < word.length());
+            verify (stack.size() > 1);
+
+            QString inside = stack.back().trimTest ('['), answer = stack.back().answer;
+            stack.pop_back();
+
+            QChar next = word[++i];
+            if (next != ' ' && next != '-')
+            {
+                stack.back().append (Word ("(", answer).append (inside, "").append (") ", ""));
+                i--;
+            }
+            else
+            {
+                stack.back().append (Word ("(", answer + next).append (inside, "").append (") ", ""));
+            }
+        }
+        else if (word[i] == '{')
+        {
+            stack.push_back (Word ("{", ""));
+        }
+        else if (word[i] == '}')
+        {
+            verify (stack.size() > 1);
+
+            QString inside = stack.back().trimTest ('{');
+            stack.pop_back();
+            stack.back().append (Word ("<i><font color=#969696>(", "").append (inside, "").append (")</font></i>", ""));
+        }
+        else if (word[i] == '`')
+        {
+            verify (i + 1 < word.length());
+            QChar stressed = word[++i];
+            stack.back().append (Word (QString (stressed), "<font color=#FF0000>").append ("", QString (stressed)).append ("", "&#769;</font>"));
+            stack.back().insertStress();
+        }
+        else if (word[i] == '!')
+        {
+            stack.back().append ("<font color=#FF0000>..</font>", "");
+        }
+        else if (word[i] == '^')
+        {
+            verify (i + 1 < word.length());
+            QChar capitalized = word[++i];
+            bool isCapitalized = capitalized != capitalized.toLower();
+            Word prefix = Word ("<font color=#969696>", (isCapitalized ? "<font color=#FF0000>" : ""));
+            stack.back().append (prefix.append (QString (capitalized.toLower()), QString (capitalized)).append (Word ("</font>", isCapitalized ? "</font>" : "")));
+            stack.back().insertStress();
+        }
+        else
+        {
+            stack.back().append (word[i]);
+        }
+    }
+
+    verify (stack.size() == 1);
+    outQuestion = stack.back().test;
+    outAnswer = stack.back().answer;
+}
@@ -0,0 +1,40 @@
+#ifndef WORD_SPELLING_MARKUP_H
+#define WORD_SPELLING_MARKUP_H
+
+#include <QString>
+#include <QVector>
+
+// Word-spelling markup compiled into a flat program, with every bracket linked to its partner, so that both
+// sides of a card are rendered in one pass without building intermediate strings.
+//
+// Markup: '\' escapes the next character other than a backslash, "(..)" is a part left out of the question,
+// "[..]" a part shown in parentheses in the question (a space or a dash after it only goes to the answer),
+// "{..}" a remark shown in the question only, '`x' a stressed letter, '^x' a letter whose case is asked,
+// '!' a gap.
+struct WordMarkupToken
+{
+    enum class Kind : quint8
+    {
+        TEXT,
+        OPEN,
+        CLOSE,
+        STRESS,
+        GAP,
+        CAPITAL
+    };
+    
+    Kind kind;
+    QChar symbol, operand;
+    int partner;
+};
+
+// Returns false for anything irregular (unbalanced or mismatched brackets, a missing operand); such words
+// are left to the general parser, which reports the problem
+bool compileWordMarkup (const QString& word, QVector <WordMarkupToken>& program);
+
+void renderWordMarkup (const QVector <WordMarkupToken>& program, QString& question, QString& answer);
+
+// The general renderer, for the words the markup compiler doesn't take; reports malformed markup
+void renderWordMarkupByStack (QString word, QString& question, QString& answer);
+
+#endif // WORD_SPELLING_MARKUP_H
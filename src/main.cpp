@@ -1,9 +1,13 @@
 #include "SceneryExecutor.h"
 #include "Util.h"
+#include "FileWatcher.h"
+#include "ExporterDaemon.h"
+#include "BatchRunner.h"
 
 #include <QFile>
 #include <QDir>
 #include <QFileInfo>
+#include <QTime>
 #include <memory>
 #include <QCoreApplication>
 
@@ -15,10 +19,55 @@ int main (int argc, char** argv)
 	QCoreApplication application (argc, argv);
 
 	initializeStandardStreams();
-	verify (argc == 2, QString ("Usage: ") + argv[0] + " scenery-file");
+
+	bool incremental = false, watch = false;
+	QString daemonSocketPath, clientSocketPath;
+	QStringList sceneryFileNames, manifestFileNames;
+
+	QStringList arguments = application.arguments().mid (1);
+	bool argumentsValid = true;
+
+	for (int i = 0; i < arguments.size(); i++)
+	{
+		bool hasValue = i + 1 < arguments.size();
+
+		if (arguments[i] == "--incremental")
+			incremental = true;
+		else if (arguments[i] == "--watch")
+			watch = true;
+		else if (arguments[i] == "--daemon" && hasValue)
+			daemonSocketPath = arguments[++i];
+		else if (arguments[i] == "--client" && hasValue)
+			clientSocketPath = arguments[++i];
+		else if (arguments[i] == "--batch" && hasValue)
+			manifestFileNames << arguments[++i];
+		else if (arguments[i].startsWith ("--"))
+			argumentsValid = false;
+		else
+			sceneryFileNames << arguments[i];
+	}
+
+	bool server = !daemonSocketPath.isEmpty() || !clientSocketPath.isEmpty();
+	bool batch = sceneryFileNames.size() > 1 || !manifestFileNames.isEmpty();
+
+	if (server)
+		argumentsValid = argumentsValid && daemonSocketPath.isEmpty() != clientSocketPath.isEmpty() && arguments.size() == 2;
+	else if (watch)
+		argumentsValid = argumentsValid && !incremental && !batch && sceneryFileNames.size() == 1;
+	else
+		argumentsValid = argumentsValid && (!sceneryFileNames.isEmpty() || !manifestFileNames.isEmpty());
+
+	verify (argumentsValid,
+	        QString ("Usage: ") + argv[0] + " [--incremental | --watch] scenery-file\n"
+	        "       " + argv[0] + " [--incremental] scenery-file... [--batch manifest-file]...\n"
+	        "       " + argv[0] + " --daemon socket-path\n"
+	        "       " + argv[0] + " --client socket-path < requests");
+
+	if (!clientSocketPath.isEmpty())
+		return ExporterDaemon::runClient (clientSocketPath, qstdin) ? 0 : 1;
 
 	QString invokePath = QDir::currentPath();
-	FileReaderSingletone::instance().pushFileSearchPath (invokePath, "global");
+	FileReaderSingletone::instance().addGlobalFileSearchPath (invokePath, "global");
 
 	QDir applicationDir (QCoreApplication::applicationDirPath());
 	if (applicationDir.exists())
@@ -26,27 +75,115 @@ int main (int argc, char** argv)
 		for (int t = 0; t < 2; t++)
 		{
 			if (QDir (applicationDir.filePath ("headers")).exists())
-				FileReaderSingletone::instance().pushFileSearchPath (applicationDir.filePath ("headers"), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+				FileReaderSingletone::instance().addGlobalFileSearchPath (applicationDir.filePath ("headers"), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
 			if (!applicationDir.cdUp()) break;
 		}
 	}
 
-	QPair <QString, QString> sceneryContents = FileReaderSingletone::instance().readContents (argv[1], "global");
+	if (!daemonSocketPath.isEmpty())
+	{
+		ExporterDaemon exporterDaemon (daemonSocketPath);
+		exporterDaemon.run();
+		return 0;
+	}
+
+	if (batch)
+	{
+		BatchRunner batchRunner;
+		for (QString fileName: sceneryFileNames)
+			batchRunner.addScenery (fileName);
+		for (QString fileName: manifestFileNames)
+			batchRunner.addManifest (fileName);
+
+		return batchRunner.run (incremental) ? 0 : 1;
+	}
+
+	QPair <QString, QString> sceneryContents = FileReaderSingletone::instance().readContents (sceneryFileNames.first(), "global");
 
 	//QString sceneryFilePath = QFileInfo (argv[1]).absolutePath();
 
+	shared_ptr <SceneryExecutor> sceneryExecutor (new SceneryExecutor (sceneryContents.first));
+	if (!sceneryExecutor->parse())
+	{
+		qstdout << "There were parse errors, exiting." << endl;
+		return 1;
+	}
+
+	//sceneryExecutor->dump();
+	sceneryExecutor->setSceneryFileName (sceneryContents.second);
+
+	// In watch mode a broken database or a missing include is reported, and the next change is waited for
+	if (watch)
+		setRecoverableFailures (true);
+
+	try
 	{
-		shared_ptr <SceneryExecutor> sceneryExecutor (new SceneryExecutor (sceneryContents.first));
-		if (!sceneryExecutor->parse())
+		if (incremental)
+			sceneryExecutor->executeIncrementally();
+		else
+			sceneryExecutor->execute();
+	}
+	catch (HaltException&)
+	{
+		qstdout << "There were errors, waiting for changes." << endl;
+	}
+	qstdout.flush();
+	qstderr.flush();
+
+	if (watch)
+	{
+		FileWatcher watcher;
+		QString sceneryPath = QFileInfo (sceneryContents.second).absoluteFilePath();
+
+		for (;;)
 		{
-			qstdout << "There were parse errors, exiting." << endl;
-			return 1;
+			QSet <QString> watchedFiles = sceneryExecutor->getSourceFiles();
+			watchedFiles.insert (sceneryPath);
+			watcher.setWatchedFiles (watchedFiles);
+
+			qstdout << "\nWatching " << watchedFiles.size() << " files for changes." << endl;
+			QSet <QString> changedFiles = watcher.waitForChanges();
+			FileReaderSingletone::instance().invalidateFileStatus();
+
+			QTime timer;
+			timer.start();
+
+			try
+			{
+				if (changedFiles.contains (sceneryPath))
+				{
+					// The commands themselves changed, nothing from the previous run can be trusted
+					qstdout << "Scenery file changed, running it from scratch." << endl;
+
+					shared_ptr <SceneryExecutor> updatedExecutor (new SceneryExecutor (FileReaderSingletone::instance().readContents (sceneryPath, "global").first));
+					if (!updatedExecutor->parse())
+					{
+						qstdout << "There were parse errors, keeping the previous scenery." << endl;
+						continue;
+					}
+
+					updatedExecutor->setSceneryFileName (sceneryPath);
+					sceneryExecutor = updatedExecutor;
+					sceneryExecutor->execute();
+				}
+				else
+				{
+					for (QString file: changedFiles)
+						qstdout << "Changed: '" << file << "'." << endl;
+
+					sceneryExecutor->reexecute (changedFiles);
+				}
+
+				qstdout << "Updated in " << timer.elapsed() << " ms." << endl;
+			}
+			catch (HaltException&)
+			{
+				qstdout << "There were errors, waiting for further changes." << endl;
+			}
+
+			qstdout.flush();
+			qstderr.flush();
 		}
-
-		//sceneryExecutor->dump();
-		sceneryExecutor->execute();
-		qstdout.flush();
-		qstderr.flush();
 	}
 
 	/*QString monthNames = readContents ("../configs/months.txt");
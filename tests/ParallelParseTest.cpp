@@ -0,0 +1,159 @@
+// Parses the fixture databases on many threads at once and checks that every parse gets exactly what a serial
+// parse does: the same deck, parser messages and source files. Parses share the file caches, the compiled
+// expressions and the include prefetch pool, so this is where they would trip over each other.
+//
+// Usage: parallel-parse-test repository-root
+
+#include "FlashcardsDatabaseParser.h"
+#include "HistoricalFlashcards.h"
+#include "QuestionFlashcard.h"
+#include "WordSpellingFlashcard.h"
+#include "DatabaseExporter.h"
+#include "Utf8.h"
+#include "Util.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QCoreApplication>
+#include <functional>
+
+namespace
+{
+	const int ROUNDS = 8;
+
+	struct ParseResult
+	{
+		QString deck, messages;
+		QStringList sourceFiles;
+
+		bool operator== (const ParseResult& other) const
+		{
+			return deck == other.deck && messages == other.messages && sourceFiles == other.sourceFiles;
+		}
+	};
+
+	class FunctionTask : public QRunnable
+	{
+	public :
+		FunctionTask (std::function <void()> function) :
+			function (function)
+		{}
+
+		void run()
+		{
+			function();
+		}
+
+	private :
+		std::function <void()> function;
+	};
+
+	// What a load and an export of the test scenery do
+	ParseResult parseFixture (QString path)
+	{
+		QPair <QString, QString> fileContents = FileReaderSingletone::instance().readContents (path, "global");
+
+		shared_ptr <DatabaseParser> parser (new DatabaseParser);
+		parser->registerBlockParser <HistoryBlockParser> ("history");
+		parser->registerBlockParser <QuestionBlockParser> ("question");
+		parser->registerBlockParser <WordSpellingBlockParser> ("russian-wordspelling");
+
+		shared_ptr <VariableStack> variableStack (new VariableStack);
+		QPair <QString, QString> globalHeaderContents = FileReaderSingletone::instance().readContents ("global.txt", DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+		shared_ptr <FlashcardsDatabase> globalHeader = parser->parseDatabase (globalHeaderContents.second, globalHeaderContents.first, nullptr, variableStack);
+		shared_ptr <FlashcardsDatabase> database = parser->parseDatabase (fileContents.second, fileContents.first, globalHeader, nullptr);
+		database->buildIndexes();
+
+		ParseResult result;
+		for (FileLocationMessage& message: database->messages)
+			result.messages += message.fileName + ":" + QString::number (message.line) + ": " + message.message + "\n";
+
+		result.sourceFiles = database->sourceFiles.toList();
+		result.sourceFiles.sort();
+
+		shared_ptr <VariableStack> exportArguments (new VariableStack);
+		exportArguments->pushVariable ("history-event-export-mode", "name-to-date-and-definition");
+		exportArguments->pushVariable ("history-term-export-mode", "inverse");
+
+		FlashcardsDeck deck;
+		DatabaseExporter exporter (database.get());
+		exporter.exportDatabase (&deck, exportArguments->currentState());
+
+		QByteArray deckBytes;
+		{
+			QBuffer buffer (&deckBytes);
+			buffer.open (QIODevice::WriteOnly);
+			Utf8Writer writer (buffer);
+			deck.writeDeck (writer);
+			writer.flush();
+		}
+		result.deck = QString::fromUtf8 (deckBytes);
+
+		return result;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	QCoreApplication application (argc, argv);
+	initializeStandardStreams();
+
+	QStringList arguments = application.arguments();
+	verify (arguments.size() == 2, QString ("Usage: ") + argv[0] + " repository-root");
+
+	QDir root (arguments[1]);
+	FileReaderSingletone::instance().addGlobalFileSearchPath (root.absolutePath(), "global");
+	FileReaderSingletone::instance().addGlobalFileSearchPath (root.absoluteFilePath ("headers"), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+
+	// The image databases/include-test.txt shows isn't in the repository; only its path matters to the parser
+	verify (QDir::current().mkpath ("images"), "Failed to create the images directory.");
+	QFile image (QDir::current().filePath ("images/watermelon.jpg"));
+	verify (image.open (QIODevice::WriteOnly), "Failed to create a stand-in image.");
+	image.close();
+	FileReaderSingletone::instance().addGlobalFileSearchPath (QDir::currentPath(), DATABASE_INCLUDE_DIRECTORIES_CONTEXT);
+
+	QStringList fixtures = QStringList() << "databases/test.txt" << "databases/include-test.txt";
+
+	// In parallel first, while the caches are cold
+	QVector <ParseResult> parallelResults (ROUNDS * fixtures.size());
+	{
+		QThreadPool pool;
+		pool.setMaxThreadCount (qMax (4, QThread::idealThreadCount()));
+
+		for (int i = 0; i < parallelResults.size(); i++)
+			pool.start (new FunctionTask ([&, i] () { parallelResults[i] = parseFixture (fixtures[i % fixtures.size()]); }));
+
+		pool.waitForDone();
+	}
+
+	FileReaderSingletone::instance().invalidateFileStatus();
+
+	QVector <ParseResult> serialResults;
+	for (QString fixture: fixtures)
+		serialResults.push_back (parseFixture (fixture));
+
+	int mismatches = 0;
+	for (int i = 0; i < parallelResults.size(); i++)
+	{
+		const ParseResult& expected = serialResults[i % fixtures.size()];
+		if (parallelResults[i] == expected)
+			continue;
+
+		mismatches++;
+		qstdout << "Parallel parse " << i << " of '" << fixtures[i % fixtures.size()] << "' differs from the serial one:"
+		        << (parallelResults[i].deck != expected.deck ? " deck" : "")
+		        << (parallelResults[i].messages != expected.messages ? " messages" : "")
+		        << (parallelResults[i].sourceFiles != expected.sourceFiles ? " source files" : "") << endl;
+	}
+
+	for (int i = 0; i < fixtures.size(); i++)
+		qstdout << "'" << fixtures[i] << "': " << serialResults[i].deck.count ('\n') << " deck lines, "
+		        << serialResults[i].sourceFiles.size() << " source files." << endl;
+
+	qstdout << parallelResults.size() << " parallel parses, " << mismatches << " mismatches." << endl;
+	return mismatches == 0 ? 0 : 1;
+}